@@ -14,85 +14,123 @@
  */
 #include "lfcas.h"
 
-template <class T>
+// Ordered map from T to V, or a set of T when V is no_value. Keys are
+// ordered by Compare, which must be stateless. LeafT is the container held
+// by base nodes (treap_leaf or flat_leaf), Reclaimer decides when
+// unlinked nodes are freed (lfcas_reclaim.h), Adaptation when base nodes
+// are split and joined (lfcas_adapt.h) and Helping whether blocked
+// operations help each other (helping or no_helping).
+template <class T, class V = no_value, class Compare = std::less<T>,
+          template <class, class, class> class LeafT = treap_leaf, class Reclaimer = epoch_reclaimer,
+          class Adaptation = default_adaptation, class Helping = helping>
 class lfcatree {
+    public:
+    typedef LeafT<T, V, Compare> Leaf;
+    typedef lfcat<T, Leaf> tree_type;
+
+    private:
+    typedef node<T, Leaf> node_t; // Either kind, check `type` before casting
+    typedef route_node<T, Leaf> route_t;
+    typedef base_node<T, Leaf> base_t;
+    typedef join_info<T, Leaf> join_t;
+    typedef txn_info<T, Leaf> txn_t;
+    typedef std::unordered_map<base_t*, base_t*> version_map; // Versions a snapshot scan has resolved
+
 	//=== Help Functions ================================
 	private:
     // Insertion and Removal
     // Does a CAS to attempt to change the pointer of the base node's parent to
     // a new base node with the updated leaf container.
-    bool try_replace(lfcat<T>* m, node<T>* b, node<T>* new_b) {
+    bool try_replace(lfcat<T, Leaf>* m, base_t* b, node_t* new_b) {
+        node_t* expected = b;
+        bool replaced = false;
 	    if(b->parent == NULL) {
-	        return m->root.compare_exchange_weak(b, new_b, // cas
+	        replaced = m->root.compare_exchange_strong(expected, new_b, // cas
                    std::memory_order_release, std::memory_order_relaxed);
         } else if((&b->parent->left)->load() == b) { // b is on left
-	        return b->parent->left.compare_exchange_weak(b, new_b, // cas
+	        replaced = b->parent->left.compare_exchange_strong(expected, new_b, // cas
                    std::memory_order_release, std::memory_order_relaxed);
         } else if((&b->parent->right)->load() == b) { // b is on right
-	        return b->parent->right.compare_exchange_weak(b, new_b, // cas
+	        replaced = b->parent->right.compare_exchange_strong(expected, new_b, // cas
                    std::memory_order_release, std::memory_order_relaxed);
-        } else {
-            return false;
         }
+        if(!replaced) STAT_INC(stat_cas_failure);
+        return replaced;
 	}
 
     // Insertion and Removal || Range Query
     // True if not in the first part of a join or not in a range query (where
     // its result is not set).
-	bool is_replaceable(node<T>* n) {
+	bool is_replaceable(base_t* n) {
         if(n == NULL) {
             return false;
         }
 	    bool status = (n->type == normal ||
 	    (n->type == joinmain &&
-	      (&n->neigh2)->load() == aborted_status) ||
+	      (&n->join->neigh2)->load() == aborted_status) ||
 	    (n->type == joinneighbor &&
-	     ((&n->main_node->neigh2)->load() == aborted_status ||
-	      (&n->main_node->neigh2)->load() == done_status)) ||
-	    (n->type == range &&
+	     ((&n->join->neigh2)->load() == aborted_status ||
+	      (&n->join->neigh2)->load() == done_status)) ||
+	    (n->type == range && n->storage->txn == NULL && // multi-key updates are replaced by installing them
 	     (&n->storage->result)->load() != not_set_status)); // current result is set
         return status;
 	}
 
     // Insertion and Removal
     // Help other thread complete their function and guarantee progress.
-    void help_if_needed(lfcat<T>* t, node<T>* n) {
-        if(n == NULL || t == NULL) return;
-        if(n->type == joinneighbor) n = n->main_node; // Node is in the middle of a join
-        if(n->type == joinmain && (&n->neigh2)->load() == preparing_status) { // The neighbor of n has been joined
-            (&n->neigh2)->compare_exchange_weak(preparing_status, aborted_status, // cas todo
+    // Does nothing without helping; callers then search again.
+    void help_if_needed(lfcat<T, Leaf>* t, base_t* n) {
+        if(!Helping::enabled || n == NULL || t == NULL) return;
+        if(n->type == joinneighbor) { // Node is in the middle of a join
+            base_t* neigh2 = (&n->join->neigh2)->load();
+            if(neigh2 == aborted_status || neigh2 == done_status) return;
+            n = n->join->main_node; // still reachable since the join is in progress
+        }
+        if(n->type == joinmain && (&n->join->neigh2)->load() == preparing_status) { // The neighbor of n has been joined
+            STAT_INC(stat_help);
+            base_t* preparing = preparing_status;
+            (&n->join->neigh2)->compare_exchange_strong(preparing, aborted_status, // cas todo
             std::memory_order_release, std::memory_order_relaxed);
 
-        } else if(n->type == joinmain && (&n->neigh2)->load() > aborted_status) { // Help the second phase of the join
+        } else if(n->type == joinmain && (&n->join->neigh2)->load() > aborted_status) { // Help the second phase of the join
+            STAT_INC(stat_help);
         	complete_join(t, n);
+        } else if(n->type == range && n->storage->txn != NULL) { // Help the multi-key update
+            STAT_INC(stat_help);
+            if((&n->storage->result)->load() == not_set_status) claim_all(t, n->storage);
+            install(t, n);
         } else if(n->type == range && (&n->storage->result)->load() == not_set_status) { // Help the range query
-        	all_in_range(t, n->lo, n->hi, n->storage);
+            STAT_INC(stat_help);
+            if(n->storage->parallel) { // its parts may hold base nodes past ours, so finishing it could wait on us
+                range_leaves<T, Leaf>* not_set = not_set_status;
+                (&n->storage->result)->compare_exchange_strong(not_set, aborted_range_status);
+            } else {
+        	    all_in_range(t, n->storage->lo, n->storage->hi, n->storage);
+            }
         }
     }
 
     // Insertion and Removal || Range Query
     // Calculates the statistics value based on its base node and detected
     // contention. Make more fine-grained in high contention and vice versa.
-    int new_stat(node<T>* n, contention_info info) {
-    	int range_sub = 0;
-    	if(n->type == range && (&n->storage->more_than_one_base)->load())
-    		range_sub = RANGE_CONTRIB;
-    	if (info == contended && n->stat <= HIGH_CONT) {
-    		return n->stat + CONT_CONTRIB - range_sub;
-    	} else if(info == uncontened && n->stat >= LOW_CONT) {
-    		return n->stat - LOW_CONT_CONTRIB - range_sub;
-    	} else return n->stat;
+    int new_stat(base_t* n, contention_info info) {
+    	bool multi_base = n->type == range && (&n->storage->more_than_one_base)->load();
+    	return adaptation.next_stat(n->stat, info, multi_base);
     }
 
     // Insertion and Removal || Range Query
-    // Begin the process of adaptation
-    void adapt_if_needed(lfcat<T>* t, node<T>* b) {
-    	if(!is_replaceable(b)) {
-            return;
-        } else if(new_stat(b, noinfo) > HIGH_CONT) {
-    		high_contention_adaptation(t, b);
-        } else if(new_stat(b, noinfo) < LOW_CONT) {
-    		low_contention_adaptation(t, b);
+    // Begin the process of adaptation, as decided by the adaptation policy.
+    // `path` is the search path that found b's predecessor, if known.
+    // A policy that never adapts is checked first, so it costs no loads of
+    // shared state.
+    void adapt_if_needed(lfcat<T, Leaf>* t, base_t* b, stack<T, Leaf>* path = NULL) {
+        if(!Adaptation::enabled) return;
+        size_t n = Leaf::size(b->data);
+        int stat = new_stat(b, noinfo);
+        if(adaptation.split(stat, n)) {
+    		if(is_replaceable(b)) high_contention_adaptation(t, b);
+        } else if(adaptation.join(stat, n)) {
+    		if(is_replaceable(b)) low_contention_adaptation(t, b, path);
         }
     }
 
@@ -100,255 +138,658 @@ class lfcatree {
     // Linearizable upon success; operation is retired upon failure. A
     // replacement attempt is made only if the found base node is replacable.
     // If it is not, it may be involved in another operation, and `do_update`
-    // will first attempt to help this operation before proceeding.
-    bool do_update(lfcat<T>* m, char mode, int i) {
+    // will first attempt to help this operation before proceeding. Either
+    // way the retry counts as contended, and a retry after a lost race to
+    // another update first backs off.
+    bool do_update(lfcat<T, Leaf>* m, char mode, const T& key, const V& value) {
     	contention_info cont_info = uncontened;
-		node<T>* base;
+		base_t* base;
+        stack<T, Leaf> path; // kept so a join does not search for the grandparent again
+        backoff wait;
 
     	while(true) {
-    		base = find_base_node((&m->root)->load(), i);
+    		base = find_base_stack((&m->root)->load(), key, &path);
     		if(is_replaceable(base)) {
  	   			bool res;
-    			node<T>* newb;
-                newb = new node<T>();
+    			base_t* newb;
+                newb = new base_t(normal);
 
-    			newb->type = normal;
 				newb->parent = base->parent;
+                new_version(newb, base);
 
-                if(mode == 'i')
-				    newb->data = vector_insert(base->data, i, &res); // treap, int, boolean
+                if(mode == 'i' || mode == 'p') // 'p' also replaces the value of an existing key
+				    newb->data = Leaf::insert(base->data, key, value, mode == 'p', &res); // leaf, key, value, assign, boolean
                 else if (mode == 'r')
-				    newb->data = vector_remove(base->data, i, &res); // treap, int, boolean
+				    newb->data = Leaf::remove(base->data, key, &res); // leaf, key, boolean
 
 				newb->stat = new_stat(base, cont_info);
     			if(try_replace(m, base, newb)) {
-    				adapt_if_needed(m, newb);
+                    init_ts(newb);
+    				Reclaimer::retire(base, free_base);
+    				adapt_if_needed(m, newb, &path);
     				return res;
     			}
+    			free_base(newb); // never published
+    			cont_info = contended;
+    			wait.wait();
+			} else {
+    			cont_info = contended;
+    			help_if_needed(m, base);
 			}
     	}
-    	cont_info = contended;
-    	help_if_needed(m, base);
     }
 
-    //=== Vector Functions ==========================
-    // Insertion and Removal
-    std::vector<T>* vector_insert(std::vector<T>* node_data, int i, bool* res) {
-        std::vector<T>* new_data = node_data;
-        new_data->push_back(i);
-        *res = true;
-        return new_data;
+    //=== Reclamation Functions =====================
+    // Frees a node but not its leaf container. Used when the leaf has been
+    // handed over to a copy of the node (range bases and join nodes).
+    static void free_node(void* p) {
+        node_t* n = (node_t*)p;
+        if(n->type == route) {
+            delete static_cast<route_t*>(n);
+            return;
+        }
+        base_t* b = static_cast<base_t*>(n);
+        if(b->type == range) release_storage(b->storage);
+        if((b->type == joinmain || b->type == joinneighbor) &&
+           (&b->join->refs)->fetch_sub(1) == 1)
+            delete b->join;
+        delete b;
     }
 
-    // Insertion and Removal
-    std::vector<T>* vector_remove(std::vector<T>* node_data, int i, bool* res) {
-        std::vector<T>* new_data = node_data;
-        new_data->erase(std::remove(new_data->begin(), new_data->end(), i));
-        *res = true;
-        return new_data;
+    // Frees a base node together with its leaf container.
+    static void free_base(void* p) {
+        base_t* n = (base_t*)p;
+        Leaf::release(n->data);
+        free_node(n);
     }
 
-    // Lookup
-    T vector_lookup(std::vector<T>* node_data, int i) {
-        std::vector<T>* new_data = node_data;
-        std::vector<int>::iterator it;
-        it = std::find(node_data->begin(), node_data->end(), i);
-        return *it;
+    // Drops one reference to a range query's result storage.
+    static void release_storage(void* p) {
+        range_result<T, Leaf>::release((rs<T, Leaf>*)p);
     }
 
+    //=== Stack Functions ===========================
     // Range Query
-    void vector_query(std::vector<T>* result) {
-        /*
-        lock.lock();
-        std::cout << result << "\n";
-        lock.unlock();
-        */
+    void reserve(stack<T, Leaf>* s, int n) {
+        if(n <= s->cap) return;
+        int cap = s->cap;
+        while(cap < n) cap *= 2;
+        node_t** items = new node_t*[cap];
+        std::copy(s->items, s->items + s->size, items);
+        if(s->items != s->inline_items) delete[] s->items;
+        s->items = items;
+        s->cap = cap;
     }
 
-    // Range Query || Adaptations
-    std::vector<T>* vector_join(std::vector<T>* a, std::vector<T>* b) {
-        std::vector<T>* ab;
-        ab->reserve(a->size() + b->size() ); // preallocate memory
-        ab->insert( ab->end(), a->begin(), a->end() );
-        ab->insert( ab->end(), b->begin(), b->end() );
-        return ab;
+    // Range Query
+    void push(stack<T, Leaf>* s, node_t* n) {
+        if(s->size == s->cap) reserve(s, s->size + 1);
+        s->items[s->size++] = n;
     }
 
-    // Adaptations
-    // Get a suitable median value for the left and right base nodes' route node.
-    int split_key(std::vector<T>* data) {
-        return data->at(data->size() / 2);
+    // Range Query
+    node_t* pop(stack<T, Leaf>* s) {
+        if(s->size == 0) return NULL;
+        return s->items[--s->size];
     }
 
-    // Adaptations
-    // Split the data in half less than the route node key's value.
-    std::vector<T>* split_left(std::vector<T>* data, int key) {
-        std::vector<int>::iterator it;
-        it = std::find(data->begin(), data->end(), key);
-        int index = std::distance(data->begin(), it);
-
-        std::vector<int>* left = new std::vector<int>(data->begin(), data->begin() + index + 1);
-        return left;
+    // Range Query
+    node_t* top(stack<T, Leaf>* s) {
+        if(s->size == 0) return NULL;
+        return s->items[s->size - 1];
     }
 
-    // Adaptations
-    // Split the data in half greater than the route node key's value.
-    std::vector<T>* split_right(std::vector<T>* data, int key) {
-        std::vector<int>::iterator it;
-        it = std::find(data->begin(), data->end(), key);
-        int index = std::distance(data->begin(), it);
-
-        std::vector<int>* right = new std::vector<int>(data->begin() + index + 1, data->end());
-        return right;
+    // Range Query
+    void replace_top(stack<T, Leaf>* s, node_t* n) {
+        s->items[s->size - 1] = n;
     }
 
-    //=== Stack Functions ===========================
     // Range Query
-    void push(stack<T>* s, node<T>* n) {
-        if(s == NULL || s->stack_lib == NULL) {
-            s->stack_lib = new std::stack<node<T>*>(); // stack_reset
-            s->stack_array = new std::vector<node<T>*>();
-        }
-        s->stack_lib->push(n);
-        s->stack_array->insert(s->stack_array->begin(), n);
-        return;
+    // Makes dst a copy of src, used to save and restore the search path.
+    void copy_state(stack<T, Leaf>* dst, stack<T, Leaf>* src) {
+        reserve(dst, src->size);
+        std::copy(src->items, src->items + src->size, dst->items);
+        dst->size = src->size;
     }
 
-    // Range Query
-    node<T>* pop(stack<T>* s) {
-        if(s == NULL || s->stack_lib == NULL) return NULL;
-        node<T>* n = s->stack_lib->top();
+    //=== Public Interface ==========================
+	public:
+    std::mutex lock;
+    Adaptation adaptation; // Split and join heuristic (lfcas_adapt.h)
+    query_workers workers; // Collect the sub-ranges of parallel range queries
+    base_t* preparing_status;
+    base_t* done_status;
+    base_t* aborted_status;
+    range_leaves<T, Leaf>* not_set_status;
+    range_leaves<T, Leaf>* aborted_range_status;
+    range_leaves<T, Leaf>* committed_status;
 
-        s->stack_lib->pop();
-        s->stack_array->erase(s->stack_array->begin());
-        return n;
+    lfcatree() {
+        preparing_status = (base_t*)0;
+        done_status = (base_t*)1;
+        aborted_status = (base_t*)2;
+        not_set_status = NOT_SET;
+        aborted_range_status = RANGE_ABORTED;
+        committed_status = TXN_COMMITTED;
     }
 
-    // Range Query
-    node<T>* top(stack<T>* s) {
-        return s->stack_lib->top();
+    // Creation
+    // A new empty tree. Free it with destroy.
+    lfcat<T, Leaf>* create() {
+        lfcat<T, Leaf>* tree = new lfcat<T, Leaf>();
+        tree->root = new base_t(normal);
+        return tree;
     }
 
-    // Range Query
-    void replace_top(stack<T>* s, node<T>* n) {
-        pop(s);
-        push(s, n);
+    // Creation
+    // Frees a tree from create, bulk_load or restore and every node and leaf
+    // in it. No thread may still be using the tree; nodes already retired by
+    // its updates are left to the reclaimer.
+    void destroy(lfcat<T, Leaf>* tree) {
+        free_tree((&tree->root)->load());
+        delete tree;
     }
 
-    // Range Query
-    stack<T> copy_state(stack<T>* s) {
-        stack<T> q;
-        q.stack_lib = s->stack_lib;
-        q.stack_array = s->stack_array;
-        return q;
+    // Insertion and Removal
+    // True if key was not in the tree. An existing key keeps its value.
+    bool insert(lfcat<T, Leaf>* m, const T& key, const V& value = V()) {
+        typename Reclaimer::guard g;
+    	return do_update(m, 'i', key, value);
     }
 
-    //=== Public Interface ==========================
-	public:
-    std::mutex lock;
-    node<T>* preparing_status;
-    node<T>* done_status;
-    node<T>* aborted_status;
-    std::vector<T>* not_set_status;
+    // Insertion and Removal
+    // Like insert, but an existing key gets the new value.
+    bool put(lfcat<T, Leaf>* m, const T& key, const V& value) {
+        typename Reclaimer::guard g;
+    	return do_update(m, 'p', key, value);
+    }
 
-    lfcatree() {
-        preparing_status = (node<T>*)0;
-        done_status = (node<T>*)1;
-        aborted_status = (node<T>*)2;
-        std::vector<T>* not_set_status = (std::vector<T>*)1;
+    // Insertion and Removal
+    bool remove(lfcat<T, Leaf>* m, const T& key) {
+        typename Reclaimer::guard g;
+    	return do_update(m, 'r', key, V());
     }
 
     // Insertion and Removal
-    bool insert(lfcat<T>* m, int i) {
-    	return do_update(m, 'i', i);
+    // Inserts the entries [first, last) (keys, or (key, value) pairs for
+    // maps) and returns how many keys were new. The batch is sorted and then
+    // applied with one replacement per base node it touches. Each base node's
+    // share is linearizable on its own, the batch as a whole is not atomic.
+    template <class It>
+    size_t insert_batch(lfcat<T, Leaf>* m, It first, It last) {
+        std::vector<typename std::iterator_traits<It>::value_type> batch(first, last);
+        sort_batch(&batch);
+        typename Reclaimer::guard g;
+        return do_batch_update(m, 'i', &batch);
     }
 
     // Insertion and Removal
-    bool remove(lfcat<T>* m, int i) {
-    	return do_update(m, 'r', i);
+    // Removes the keys [first, last) and returns how many were in the tree.
+    template <class It>
+    size_t remove_batch(lfcat<T, Leaf>* m, It first, It last) {
+        std::vector<T> batch(first, last);
+        sort_batch(&batch);
+        typename Reclaimer::guard g;
+        return do_batch_update(m, 'r', &batch);
+    }
+
+    // Multi-key Update
+    // Applies the inserts ('i'), puts ('p') and removes ('r') in ops as one
+    // atomic step, so no other operation sees some of them done and others
+    // not. Sets the result of each like the matching single-key function.
+    // False, and nothing changes, if two ops have the same key. The base
+    // nodes holding the keys are claimed in key order like a range query
+    // claims its base nodes, and replaced together once all are claimed;
+    // blocked threads help finish it.
+    bool update(lfcat<T, Leaf>* m, std::vector<update_op<T, V> >* ops) {
+        if(ops->empty()) return true;
+        std::vector<size_t> order(ops->size());
+        for(size_t i = 0; i < order.size(); i++) order[i] = i;
+        std::sort(order.begin(), order.end(), [ops](size_t a, size_t b) {
+            return Leaf::less((*ops)[a].key, (*ops)[b].key);
+        });
+        for(size_t i = 1; i < order.size(); i++) {
+            if(!Leaf::less((*ops)[order[i - 1]].key, (*ops)[order[i]].key)) return false;
+        }
+        txn_t* x = new txn_t(ops->size());
+        for(size_t i = 0; i < order.size(); i++) {
+            const update_op<T, V>& o = (*ops)[order[i]];
+            x->ops[i].mode = o.mode;
+            x->ops[i].key = o.key;
+            x->ops[i].value = o.value;
+        }
+        typename Reclaimer::guard g;
+        do_multi_update(m, x);
+        for(size_t i = 0; i < order.size(); i++) (*ops)[order[i]].result = x->ops[i].result;
+        return true;
+    }
+
+    // Multi-key Update
+    // Moves the entry at `from` to `to` in one atomic step, replacing any
+    // entry at `to`. False, and nothing changes, if from is not in the tree.
+    bool move(lfcat<T, Leaf>* m, const T& from, const T& to) {
+        if(!Leaf::less(from, to) && !Leaf::less(to, from)) return lookup(m, from);
+        txn_t* x = new txn_t(2);
+        size_t f = Leaf::less(from, to) ? 0 : 1; // ops are sorted by key
+        x->ops[f].mode = 'r';
+        x->ops[f].key = from;
+        x->ops[1 - f].mode = 'm';
+        x->ops[1 - f].key = to;
+        x->ops[1 - f].src = f;
+        typename Reclaimer::guard g;
+        do_multi_update(m, x);
+        return x->ops[1 - f].result;
     }
 
     // Lookup
     // Wait free. Traverses route nodes until base node is found, then performs
     // lookup in the corresponding immutable data structure.
-    bool lookup(lfcat<T>* m, int i) {
-    	node<T>* base = find_base_node((&m->root)->load(), i);
-    	return vector_lookup(base->data, i);
+    bool lookup(lfcat<T, Leaf>* m, const T& key) {
+        typename Reclaimer::guard g;
+    	base_t* base = find_base_node((&m->root)->load(), key);
+        bool copied;
+        typename Leaf::type l = read_leaf(base, &copied);
+    	bool found = Leaf::lookup(l, key);
+        if(copied) Leaf::release(l);
+        return found;
+    }
+
+    // Lookup
+    // Copies the value of key to *value. False if key is not in the tree.
+    bool get(lfcat<T, Leaf>* m, const T& key, V* value) {
+        typename Reclaimer::guard g;
+    	base_t* base = find_base_node((&m->root)->load(), key);
+        bool copied;
+        typename Leaf::type l = read_leaf(base, &copied);
+        const V* v = Leaf::find(l, key);
+        if(v != NULL) *value = *v;
+        if(copied) Leaf::release(l);
+        return v != NULL;
+    }
+
+    // Navigation
+    // The smallest key >= key, copied to *found with its value copied to
+    // *value unless that is NULL. False if there is none. The navigation
+    // functions only read: they walk base nodes in key order along the
+    // search path instead of turning them into range bases like query. Each
+    // leaf is read atomically but the walk as a whole is not, so a key
+    // inserted into a base node already passed may be missed.
+    bool lower_bound(lfcat<T, Leaf>* m, const T& key, T* found, V* value = NULL) {
+        return next_entry(m, &key, true, found, value);
+    }
+
+    // Navigation
+    // The smallest key > key.
+    bool upper_bound(lfcat<T, Leaf>* m, const T& key, T* found, V* value = NULL) {
+        return next_entry(m, &key, false, found, value);
+    }
+
+    // Navigation
+    // Same as upper_bound.
+    bool successor(lfcat<T, Leaf>* m, const T& key, T* found, V* value = NULL) {
+        return next_entry(m, &key, false, found, value);
+    }
+
+    // Navigation
+    // The largest key < key.
+    bool predecessor(lfcat<T, Leaf>* m, const T& key, T* found, V* value = NULL) {
+        return prev_entry(m, &key, found, value);
+    }
+
+    // Navigation
+    bool min(lfcat<T, Leaf>* m, T* found, V* value = NULL) {
+        return next_entry(m, NULL, true, found, value);
+    }
+
+    // Navigation
+    bool max(lfcat<T, Leaf>* m, T* found, V* value = NULL) {
+        return prev_entry(m, NULL, found, value);
+    }
+
+    // Snapshot
+    // Calls f(key, value) for every entry of the tree as it was at one point
+    // in time, in ascending key order. Unlike query it writes nothing but
+    // timestamps, so writers run on undisturbed: base nodes that change
+    // during the scan keep links to the versions they replaced, and the
+    // scan reads the version each key had when it started. The scan holds
+    // an epoch guard throughout, so nothing unlinked meanwhile is freed
+    // before it ends.
+    template <class F>
+    void scan(lfcat<T, Leaf>* m, F f) {
+        typename Reclaimer::guard g;
+        unsigned long long snap = (&snapshot_clock::now())->fetch_add(1);
+        version_map found;
+        T lo, hi;
+        bool has_lo = false;
+        while(true) { // one base node at a time, bounded by the route keys above it
+            node_t* n = (&m->root)->load();
+            bool bounded = false;
+            while(n->type == route) {
+                route_t* r = static_cast<route_t*>(n);
+                if(!has_lo || Leaf::less(lo, r->key)) {
+                    hi = r->key;
+                    bounded = true;
+                    n = (&r->left)->load();
+                } else {
+                    n = (&r->right)->load();
+                }
+            }
+            visit_version(static_cast<base_t*>(n), has_lo ? &lo : NULL, bounded ? &hi : NULL, snap, found, f);
+            if(!bounded) return;
+            lo = hi;
+            has_lo = true;
+        }
     }
 
     // Range Query
-    // Creates a snapshot of all base nodes in the requested range, then
-    // traverses the snapshot to complete the range query
-    void query(lfcat<T>* m, int lo, int hi) {
-    	std::vector<T>* result = all_in_range(m, lo, hi, NULL);
-    	vector_query(result);
+    // Creates a snapshot of all base nodes in the requested range and returns
+    // a handle that reads the keys straight out of their leaves. With
+    // threads > 1 wide ranges are cut at route keys and collected by up to
+    // `threads` threads.
+    range_result<T, Leaf> query(lfcat<T, Leaf>* m, const T& lo, const T& hi, int threads = 1) {
+        typename Reclaimer::guard g;
+    	rs<T, Leaf>* s = all_in_range(m, lo, hi, NULL, threads);
+        (&s->refs)->fetch_add(1); // s is kept alive by the guard until now
+    	return range_result<T, Leaf>(s, lo, hi);
+    }
+
+    // Bulk Load
+    // Builds a new tree from entries (keys, or (key, value) pairs for maps)
+    // that are sorted by Compare and free of duplicates, in O(n). The
+    // entries are cut into base nodes of leaf_size entries, built by up to
+    // `threads` threads, under a balanced skeleton of route nodes.
+    template <class It>
+    lfcat<T, Leaf>* bulk_load(It first, It last, size_t leaf_size = BULK_LEAF_SIZE, int threads = 1) {
+        size_t n = last - first;
+        if(leaf_size == 0) leaf_size = 1;
+        size_t chunks = n == 0 ? 1 : (n + leaf_size - 1) / leaf_size;
+        std::vector<base_t*> bases(chunks);
+
+        if(threads < 1) threads = 1;
+        if((size_t)threads > chunks) threads = chunks;
+        std::vector<std::thread> workers;
+        for(int w = 0; w < threads; w++) {
+            workers.push_back(std::thread([&, w]() { // chunks w, w + threads, ...
+                for(size_t c = w; c < chunks; c += threads) {
+                    It lo = first + std::min(n, c * leaf_size);
+                    It hi = first + std::min(n, (c + 1) * leaf_size);
+                    base_t* b = new base_t(normal);
+                    b->data = Leaf::from_sorted(lo, hi);
+                    bases[c] = b;
+                }
+            }));
+        }
+        for(size_t w = 0; w < workers.size(); w++) workers[w].join();
+
+        lfcat<T, Leaf>* tree = new lfcat<T, Leaf>();
+        tree->root = bulk_skeleton(&bases[0], 0, chunks, NULL);
+        return tree;
+    }
+
+    // Bulk Load
+    // Route nodes over bases[lo, hi), split at the first key of the middle one.
+    node_t* bulk_skeleton(base_t** bases, size_t lo, size_t hi, route_t* parent) {
+        if(hi - lo == 1) {
+            bases[lo]->parent = parent;
+            return bases[lo];
+        }
+        size_t mid = lo + (hi - lo) / 2;
+        route_t* r = new route_t();
+        r->key = Leaf::min(bases[mid]->data);
+        r->left = bulk_skeleton(bases, lo, mid, r);
+        r->right = bulk_skeleton(bases, mid, hi, r);
+        return r;
+    }
+
+    // Dump Files
+    // Writes the entries of the tree as of one point in time, as seen by
+    // scan, to a file restore can map back in. Entries are cut into leaves
+    // of leaf_size entries, as by bulk_load. Writers are not held up, but
+    // memory they unlink is freed only after the dump. False if the file
+    // could not be written. Needs a leaf container with an image format,
+    // which flat_leaf has.
+    bool dump(lfcat<T, Leaf>* m, const char* path, size_t leaf_size = BULK_LEAF_SIZE) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if(!out) return false;
+        dump_header h = dump_header();
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h)); // no magic until the end
+        if(leaf_size == 0) leaf_size = 1;
+        std::vector<std::pair<T, V> > chunk;
+        std::vector<unsigned long long> index;
+        unsigned long long offset = sizeof(h);
+        scan(m, [&](const T& key, const V& value) {
+            chunk.push_back(std::make_pair(key, value));
+            if(chunk.size() == leaf_size) write_leaf(out, &chunk, &index, &offset);
+        });
+        if(!chunk.empty()) write_leaf(out, &chunk, &index, &offset);
+        if(!index.empty()) out.write(reinterpret_cast<const char*>(&index[0]), index.size() * sizeof(index[0]));
+        h.magic = DUMP_MAGIC;
+        h.version = DUMP_VERSION;
+        h.key_bytes = sizeof(T);
+        h.value_bytes = sizeof(V);
+        h.leaves = index.size();
+        h.index = offset;
+        out.seekp(0);
+        out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+        out.close();
+        return !out.fail();
+    }
+
+    // Dump Files
+    // A new tree holding the entries of a file written by dump. The file is
+    // mapped read-only and base nodes point at the leaves in it, so this
+    // takes time in the number of base nodes rather than of entries. Mapped
+    // leaves are never written; the first update of one copies it, as any
+    // update does. The file stays mapped until the tree is deleted and the
+    // last of its leaves is freed. NULL if the file cannot be read or was
+    // not written by dump for this tree type.
+    lfcat<T, Leaf>* restore(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if(fd < 0) return NULL;
+        struct stat st;
+        size_t n = fstat(fd, &st) == 0 ? st.st_size : 0;
+        void* p = n < sizeof(dump_header) ? MAP_FAILED : mmap(NULL, n, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if(p == MAP_FAILED) return NULL;
+
+        const char* file = static_cast<const char*>(p);
+        const dump_header* h = reinterpret_cast<const dump_header*>(file);
+        bool ok = h->magic == DUMP_MAGIC && h->version == DUMP_VERSION && h->key_bytes == sizeof(T) &&
+                  h->value_bytes == sizeof(V) && h->index % 64 == 0 && h->index <= n &&
+                  h->leaves <= (n - h->index) / sizeof(unsigned long long);
+        const unsigned long long* index = reinterpret_cast<const unsigned long long*>(file + h->index);
+        std::vector<base_t*> bases;
+        for(size_t i = 0; ok && i < h->leaves; i++) {
+            typename Leaf::type l = index[i] % 64 == 0 && index[i] < h->index ?
+                                    Leaf::map_image(file + index[i], h->index - index[i]) : NULL;
+            ok = l != NULL && (i == 0 || Leaf::less(Leaf::max(bases.back()->data), Leaf::min(l)));
+            if(ok) {
+                bases.push_back(new base_t(normal));
+                bases.back()->data = l;
+            }
+        }
+        if(!ok) {
+            for(size_t i = 0; i < bases.size(); i++) delete bases[i]; // the leaves are not counted yet
+            munmap(p, n);
+            return NULL;
+        }
+
+        lfcat<T, Leaf>* tree = new lfcat<T, Leaf>();
+        tree->mapping = mapped_file::add(p, n, bases.size() + 1); // a reference per leaf and one for the tree
+        if(bases.empty()) bases.push_back(new base_t(normal));
+        tree->root = bulk_skeleton(&bases[0], 0, bases.size(), NULL);
+        return tree;
+    }
+
+    // Dump Files
+    // Appends the entries in chunk to out as one leaf and empties it.
+    void write_leaf(std::ostream& out, std::vector<std::pair<T, V> >* chunk,
+                    std::vector<unsigned long long>* index, unsigned long long* offset) {
+        typename Leaf::type l = Leaf::from_sorted(chunk->begin(), chunk->end());
+        index->push_back(*offset);
+        *offset += Leaf::write_image(out, l);
+        Leaf::release(l);
+        chunk->clear();
+    }
+
+    // Statistics
+    // Sums the per-thread contention and adaptation counters. All zeros
+    // unless built with -DLFCAS_STATS.
+    tree_stats stats() {
+        tree_stats s = tree_stats();
+#ifdef LFCAS_STATS
+        s.cas_failures = stats_counters::total(stat_cas_failure);
+        s.helps = stats_counters::total(stat_help);
+        s.splits = stats_counters::total(stat_split);
+        s.joins = stats_counters::total(stat_join);
+        s.join_aborts = stats_counters::total(stat_join_abort);
+#endif
+        return s;
+    }
+
+    void reset_stats() {
+#ifdef LFCAS_STATS
+        stats_counters::reset();
+#endif
+    }
+
+    // Insertion and Removal
+    // Sorts a batch by key and drops repeated keys, keeping the first entry.
+    template <class E>
+    static void sort_batch(std::vector<E>* batch) {
+        std::stable_sort(batch->begin(), batch->end(), [](const E& a, const E& b) {
+            return Leaf::less(Leaf::key_of(a), Leaf::key_of(b));
+        });
+        batch->erase(std::unique(batch->begin(), batch->end(), [](const E& a, const E& b) {
+            return !Leaf::less(Leaf::key_of(a), Leaf::key_of(b));
+        }), batch->end());
+    }
+
+    // Insertion and Removal
+    // Like do_update, but replaces each base node once with all the batch
+    // entries that route to it. Contention and backoff start over with
+    // every base node.
+    template <class E>
+    size_t do_batch_update(lfcat<T, Leaf>* m, char mode, std::vector<E>* batch) {
+    	contention_info cont_info = uncontened;
+        size_t changed = 0;
+        size_t i = 0;
+        stack<T, Leaf> path;
+        backoff wait;
+        while(i < batch->size()) {
+            T bound; // keys routed to base are below bound, when bounded
+            bool bounded;
+    		base_t* base = find_base_bound((&m->root)->load(), Leaf::key_of((*batch)[i]), &bound, &bounded, &path);
+    		if(!is_replaceable(base)) {
+                cont_info = contended;
+                help_if_needed(m, base);
+                continue;
+            }
+            size_t j = i + 1;
+            while(j < batch->size() && (!bounded || Leaf::less(Leaf::key_of((*batch)[j]), bound))) j++;
+
+            size_t count;
+    		base_t* newb = new base_t(normal);
+			newb->parent = base->parent;
+            new_version(newb, base);
+            if(mode == 'i')
+                newb->data = Leaf::insert_batch(base->data, batch->begin() + i, batch->begin() + j, &count);
+            else
+                newb->data = Leaf::remove_batch(base->data, batch->begin() + i, batch->begin() + j, &count);
+			newb->stat = new_stat(base, cont_info);
+    		if(try_replace(m, base, newb)) {
+                init_ts(newb);
+    			Reclaimer::retire(base, free_base);
+    			adapt_if_needed(m, newb, &path);
+                changed += count;
+                i = j;
+                cont_info = uncontened;
+                wait = backoff();
+    		} else {
+    			free_base(newb); // never published
+                cont_info = contended;
+                wait.wait();
+            }
+        }
+        return changed;
+    }
+
+    // Insertion and Removal
+    // find_base_stack that also returns the smallest route key the search
+    // went left at, the upper bound of the keys the base node covers.
+    base_t* find_base_bound(node_t* n, const T& key, T* bound, bool* bounded, stack<T, Leaf>* s) {
+        *bounded = false;
+        s->size = 0;
+        while(n->type == route) {
+            push(s, n);
+            route_t* r = static_cast<route_t*>(n);
+            if(Leaf::less(key, r->key)) {
+                *bound = r->key;
+                *bounded = true;
+                n = (&r->left)->load();
+            } else {
+                n = (&r->right)->load();
+            }
+        }
+        push(s, n);
+        return static_cast<base_t*>(n);
     }
 
-    // Lookup || Insertion and Removal
+    // Lookup
     // Finds base nodes but does not push the results to a stack like with
     // the range query functions below.
-    node<T>* find_base_node(node<T>* n, int i) {
+    base_t* find_base_node(node_t* n, const T& key) {
         if(n == NULL) return NULL;
 
         while(n->type == route) {
-            if(i < n->key) {
-                if(n->left == NULL) break;
-                n = (&n->left)->load();
+            route_t* r = static_cast<route_t*>(n);
+            if(Leaf::less(key, r->key)) {
+                n = (&r->left)->load();
             } else {
-                if(n->right == NULL) break;
-                n = (&n->right)->load();
+                n = (&r->right)->load();
             }
         }
-        return n;
+        return static_cast<base_t*>(n);
     }
 
-    // Range Query
+    // Insertion and Removal || Range Query
     // Find base nodes in a depth first traversal through route nodes. Uses a
     // stack s to store the search path to the current base node.
-    node<T>* find_base_stack(node<T>* n, int i, stack<T>* s) {
-        if(s == NULL) {
-            s = new stack<T>();
-        }
-        if(s->stack_lib == NULL || s->stack_array == NULL) {
-            s->stack_lib = new std::stack<node<T>*>(); // stack_reset
-            s->stack_array = new std::vector<node<T>*>();
-        }
-
+    base_t* find_base_stack(node_t* n, const T& key, stack<T, Leaf>* s) {
+        s->size = 0; // stack_reset
         if (n == NULL) return NULL;
         while(n->type == route) {
             push(s, n);
-            if(i < n->key) {
-                if(n->left == NULL) break;
-                n = (&n->left)->load();
+            route_t* r = static_cast<route_t*>(n);
+            if(Leaf::less(key, r->key)) {
+                n = (&r->left)->load();
             } else {
-                if(n->right == NULL) break;
-                n = (&n->right)->load();
+                n = (&r->right)->load();
             }
         }
         push(s, n);
-        return n;
+        return static_cast<base_t*>(n);
     }
 
     // Range Query
     // Find base nodes in a depth first traversal. Uses a stack s to store the
     // search path to the current base node. Compared to the previous function,
     // the search begins from the current head of the stack
-    node<T>* find_next_base_stack(stack<T>* s) {
-        if(s == NULL) return NULL;
-    	node<T>* base = pop(s);
-    	node<T>* t = top(s);
+    base_t* find_next_base_stack(stack<T, Leaf>* s) {
+    	node_t* base = pop(s);
+    	route_t* t = static_cast<route_t*>(top(s));
     	if(t == NULL) return NULL;
 
     	if((&t->left)->load() == base)
     		return leftmost_and_stack((&t->right)->load(), s);
 
-    	int be_greater_than = t->key;
+    	T be_greater_than = t->key;
     	while(t != NULL) {
-    		if((&t->valid)->load() && t->key > be_greater_than)
+    		if((&t->valid)->load() && Leaf::less(be_greater_than, t->key))
     			return leftmost_and_stack((&t->right)->load(), s);
     		else {
 				pop(s);
-                t = top(s);
+                t = static_cast<route_t*>(top(s));
             }
     	}
     	return NULL;
@@ -356,169 +797,662 @@ class lfcatree {
 
     // Range Query
     // Used for traversal.
-    node<T>* leftmost_and_stack(node<T>* n, stack<T>* s) {
+    base_t* leftmost_and_stack(node_t* n, stack<T, Leaf>* s) {
         while (n->type == route) {
             push(s, n);
-            n = (&n->left)->load();
+            n = (&static_cast<route_t*>(n)->left)->load();
         }
 
         push(s, n);
-        return n;
+        return static_cast<base_t*>(n);
     }
 
-    // Range Query
-    // Initialize new range base.
-    node<T>* new_range_base(node<T>* b, int lo, int hi, rs<T>* s) {
-		node<T>* newrb;
-		newrb = b;
+    // Navigation
+    base_t* rightmost_and_stack(node_t* n, stack<T, Leaf>* s) {
+        while (n->type == route) {
+            push(s, n);
+            n = (&static_cast<route_t*>(n)->right)->load();
+        }
 
-		newrb->lo = lo;
-		newrb->hi = hi;
+        push(s, n);
+        return static_cast<base_t*>(n);
+    }
 
-        newrb->storage = new rs<T>();
-		newrb->storage = s;
+    // Navigation
+    // find_base_stack for the keys just below key: goes left at route nodes
+    // with that key.
+    base_t* find_base_below(node_t* n, const T& key, stack<T, Leaf>* s) {
+        s->size = 0;
+        while(n->type == route) {
+            push(s, n);
+            route_t* r = static_cast<route_t*>(n);
+            if(Leaf::less(r->key, key)) {
+                n = (&r->right)->load();
+            } else {
+                n = (&r->left)->load();
+            }
+        }
+        push(s, n);
+        return static_cast<base_t*>(n);
+    }
 
-        enum node_type type;
-        type = range;
-        newrb->type = node_type();
-        newrb->type = range;
+    // Navigation
+    // Read-only find_next_base_stack. The base node on top of s covers
+    // *bound (every key when !*bounded); the base node returned covers keys
+    // from the new *bound. The side the walk came from is told by key rather
+    // than by pointer, so base nodes replaced since s was built do not throw
+    // it off. Below a route node that a join has spliced out, the search
+    // starts over from the root.
+    base_t* find_next_base_read(lfcat<T, Leaf>* m, stack<T, Leaf>* s, T* bound, bool* bounded) {
+        pop(s);
+        while(s->size > 0) {
+            route_t* r = static_cast<route_t*>(top(s));
+            if(!*bounded || Leaf::less(*bound, r->key)) { // came from the left
+                *bound = r->key;
+                *bounded = true;
+                if((&r->valid)->load())
+                    return leftmost_and_stack((&r->right)->load(), s);
+                return find_base_stack((&m->root)->load(), *bound, s);
+            }
+            pop(s);
+        }
+        return NULL;
+    }
+
+    // Navigation
+    // Mirror of find_next_base_read. The base node returned covers the keys
+    // below the new *bound.
+    base_t* find_prev_base_read(lfcat<T, Leaf>* m, stack<T, Leaf>* s, T* bound, bool* bounded) {
+        pop(s);
+        while(s->size > 0) {
+            route_t* r = static_cast<route_t*>(top(s));
+            if(!*bounded || Leaf::less(r->key, *bound)) { // came from the right
+                *bound = r->key;
+                *bounded = true;
+                if((&r->valid)->load())
+                    return rightmost_and_stack((&r->left)->load(), s);
+                return find_base_below((&m->root)->load(), *bound, s);
+            }
+            pop(s);
+        }
+        return NULL;
+    }
+
+    // Navigation
+    // The first entry after *from, or at it if inclusive. The first entry
+    // of the tree when from is NULL.
+    bool next_entry(lfcat<T, Leaf>* m, const T* from, bool inclusive, T* found, V* value) {
+        typename Reclaimer::guard g;
+        stack<T, Leaf> s;
+        T bound;
+        bool bounded = from != NULL;
+        base_t* b;
+        if(bounded) {
+            bound = *from;
+            b = find_base_stack((&m->root)->load(), bound, &s);
+        } else {
+            b = leftmost_and_stack((&m->root)->load(), &s);
+        }
+        while(b != NULL) {
+            bool copied;
+            typename Leaf::type l = read_leaf(b, &copied);
+            bool hit = bounded ? Leaf::next(l, bound, inclusive, found, value) : Leaf::first(l, found, value);
+            if(copied) Leaf::release(l);
+            if(hit) return true;
+            b = find_next_base_read(m, &s, &bound, &bounded);
+            inclusive = true; // bound is now a route key, the first key b may hold
+        }
+        return false;
+    }
+
+    // Navigation
+    // The last entry before *before, or of the tree when before is NULL.
+    bool prev_entry(lfcat<T, Leaf>* m, const T* before, T* found, V* value) {
+        typename Reclaimer::guard g;
+        stack<T, Leaf> s;
+        T bound;
+        bool bounded = before != NULL;
+        base_t* b;
+        if(bounded) {
+            bound = *before;
+            b = find_base_below((&m->root)->load(), bound, &s);
+        } else {
+            b = rightmost_and_stack((&m->root)->load(), &s);
+        }
+        while(b != NULL) {
+            bool copied;
+            typename Leaf::type l = read_leaf(b, &copied);
+            bool hit = bounded ? Leaf::prev(l, bound, found, value) : Leaf::last(l, found, value);
+            if(copied) Leaf::release(l);
+            if(hit) return true;
+            b = find_prev_base_read(m, &s, &bound, &bounded);
+        }
+        return false;
+    }
+
+    // Range Query
+    // Initialize new range base. The copy shares b's leaf container and holds
+    // a reference to the result storage, which records the range.
+    base_t* new_range_base(base_t* b, rs<T, Leaf>* s) {
+		base_t* newrb = new base_t(range);
+        newrb->data = b->data;
+        newrb->stat = b->stat;
+        newrb->parent = b->parent;
+        copy_version(newrb, b);
+
+        (&s->refs)->fetch_add(1);
+		newrb->storage = s;
         return newrb;
 	 }
 
+    // Range Query
+    // Continues a query from b, the base node on top of s, which is already
+    // a range base of my_s: converts the following base nodes up to the
+    // first holding a key >= hi and pushes them all to done. False if the
+    // query's result was set by another thread meanwhile.
+    bool collect_rest(lfcat<T, Leaf>* t, const T& hi, rs<T, Leaf>* my_s, base_t* b, stack<T, Leaf>* s, stack<T, Leaf>* done) {
+    	stack<T, Leaf> backup_s;
+    	while(true) { // Find remaining base nodes
+	    	push(done, b); // ultimate final result stack (NOT the route nodes)
+	    	copy_state(&backup_s, s);
+
+	    	if (b->data != NULL && !Leaf::less(Leaf::max(b->data), hi)) { // maximum value
+				return true;
+            }
+	    	find_next_base_node: b = find_next_base_stack(s);
+	    	if(b == NULL) {
+                return true; // out of base nodes
+            }
+	    	else if ((&my_s->result)->load() != not_set_status) { // range query is finished
+	    		return false;
+	    	} else if (b->type == range && b->storage == my_s) { // b's storage is the same as the current
+	    		continue;
+	    	} else if (is_replaceable(b)) {
+	    		base_t* n = new_range_base(b, my_s); // change the type of node b is
+	    		if(try_replace(t, b, n)) {
+                    Reclaimer::retire(b, free_node);
+	    			replace_top(s, n);
+                    b = n;
+                    continue;
+	    		} else {
+                    free_node(n);
+	    			copy_state(s, &backup_s); // reset the stack
+	    			goto find_next_base_node;
+	    		}
+	    	} else { // another thread has intercepted; help it out
+	    		help_if_needed(t, b);
+	    		copy_state(s, &backup_s); // reset stack
+	    		goto find_next_base_node;
+	    	}
+    	}
+    }
+
+    // Range Query
+    // One sub-range [lo, hi] of a parallel query, run on a worker thread:
+    // finds and converts the base node holding lo, then collects the rest.
+    // Leaves done empty if the query's result was set meanwhile.
+    void collect_part(lfcat<T, Leaf>* t, const T& lo, const T& hi, rs<T, Leaf>* my_s, stack<T, Leaf>* done) {
+        typename Reclaimer::guard g;
+    	stack<T, Leaf> s;
+    	base_t* b;
+        find_first: b = find_base_stack((&t->root)->load(), lo, &s);
+        if((&my_s->result)->load() != not_set_status) {
+            return;
+        } else if(b->type == range && b->storage == my_s) { // converted by a neighboring part
+        } else if(is_replaceable(b)) {
+    		base_t* n = new_range_base(b, my_s);
+    		if(!try_replace(t, b, n)) {
+                free_node(n);
+                goto find_first;
+            }
+            Reclaimer::retire(b, free_node);
+    		replace_top(&s, n);
+            b = n;
+        } else {
+    		help_if_needed(t, b);
+    		goto find_first;
+        }
+        if(!collect_rest(t, hi, my_s, b, &s, done)) done->size = 0;
+    }
+
+    // Range Query
+    // Up to parts - 1 route keys strictly inside (lo, hi), ascending, taken
+    // from the top levels of the tree. They cut a wide query into sub-ranges
+    // holding similar numbers of base nodes. A range of fewer than
+    // PARALLEL_MIN_BASES base nodes per part gets fewer parts, and one that
+    // small is not cut at all.
+    std::vector<T> range_cuts(lfcat<T, Leaf>* t, const T& lo, const T& hi, int parts) {
+        std::vector<T> keys;
+        std::vector<node_t*> level(1, (&t->root)->load());
+        while(!level.empty() && keys.size() < (size_t)parts * PARALLEL_MIN_BASES) {
+            std::vector<node_t*> next;
+            for(size_t i = 0; i < level.size(); i++) {
+                if(level[i]->type != route) continue;
+                route_t* r = static_cast<route_t*>(level[i]);
+                if(Leaf::less(lo, r->key) && Leaf::less(r->key, hi)) keys.push_back(r->key);
+                if(Leaf::less(lo, r->key)) next.push_back((&r->left)->load());
+                if(!Leaf::less(hi, r->key)) next.push_back((&r->right)->load());
+            }
+            level.swap(next);
+        }
+        std::sort(keys.begin(), keys.end(), Leaf::less);
+        parts = std::min((size_t)parts, (keys.size() + 1) / PARALLEL_MIN_BASES);
+        std::vector<T> cuts;
+        for(int i = 1; i < parts && keys.size() > 0; i++) {
+            const T& k = keys[keys.size() * i / parts];
+            if(cuts.empty() || Leaf::less(cuts.back(), k)) cuts.push_back(k);
+        }
+        return cuts;
+    }
+
+    // Range Query
+    // collect_rest for a query cut into sub-ranges at `cuts`. This thread
+    // continues the first sub-range from b while a worker thread of the
+    // tree converts and collects each further sub-range. Every base node is still
+    // converted before the result is set, so the query stays linearizable.
+    // The sub-ranges' lists are concatenated into done; neighbors can both
+    // collect the base nodes around a cut, which are kept once.
+    //
+    // Unlike a sequential query, a parallel one holds base nodes that are
+    // not a prefix of its range, so two overlapping queries helping each
+    // other could wait on each other forever. Helpers therefore abort a
+    // parallel query instead of finishing it (help_if_needed), which frees
+    // its range bases, and the query is then retried sequentially.
+    bool collect_parallel(lfcat<T, Leaf>* t, const T& hi, rs<T, Leaf>* my_s, base_t* b, stack<T, Leaf>* s,
+                          const std::vector<T>& cuts, stack<T, Leaf>* done) {
+        size_t n = cuts.size() + 1;
+        stack<T, Leaf>* parts = new stack<T, Leaf>[n];
+        std::vector<std::function<void()> > jobs;
+        for(size_t j = 1; j < n; j++) {
+            const T& part_hi = j + 1 < n ? cuts[j] : hi;
+            jobs.push_back(std::bind(&lfcatree::collect_part, this, t, cuts[j - 1], part_hi, my_s, &parts[j]));
+        }
+        bool first = false;
+        workers.run(jobs, [&]() { first = collect_rest(t, cuts[0], my_s, b, s, &parts[0]); });
+
+        bool complete = first && (&my_s->result)->load() == not_set_status;
+        for(size_t j = 0; j < n && complete; j++) {
+            if(parts[j].size == 0) { // the result was set meanwhile
+                complete = false;
+                break;
+            }
+            int keep = done->size; // drop what the previous part collected from here on
+            for(int i = done->size - 1; i >= 0; i--) {
+                if(done->items[i] == parts[j].items[0]) {
+                    keep = i;
+                    break;
+                }
+            }
+            done->size = keep;
+            for(int i = 0; i < parts[j].size; i++) push(done, parts[j].items[i]);
+        }
+        delete[] parts;
+        return complete;
+    }
+
     // Range Query
     // Goes through all base nodes that may contain items in range in ascending
     // key order. Replaces each base node by type `range_base` to indicate that it
-    // is part of a range query.
-    std::vector<T>* all_in_range(lfcat<T>* t, int lo, int hi, rs<T>* help_s) {
-    	stack<T> s;
-    	stack<T> backup_s;
-    	node<T>* b;
-    	rs<T>* my_s;
+    // is part of a range query. With threads > 1 a query that spans route
+    // nodes is collected by up to that many threads.
+    rs<T, Leaf>* all_in_range(lfcat<T, Leaf>* t, const T& lo, const T& hi, rs<T, Leaf>* help_s, int threads = 1) {
+    	stack<T, Leaf> s;
+    	base_t* b;
+    	rs<T, Leaf>* my_s;
+        std::vector<T> cuts;
+        if(Helping::enabled && threads > 1 && help_s == NULL) // parts waiting on each other's queries could deadlock
+            cuts = range_cuts(t, lo, hi, threads);
 
         find_first:b = find_base_stack((&t->root)->load(),lo,&s); // Find base nodes
 
     	if(help_s != NULL) { // result storage
     		if(b->type != range || help_s != b->storage) { // update result query
-    			return (&help_s->result)->load();
+    			return help_s;
     		} else { // is a range base and storage has been set by another thread
 			    my_s = help_s;
 			}
     	} else if(is_replaceable(b)) { // result field != not_set_status
-    		my_s = new rs<T>;
-            my_s->result = new std::vector<T>();
+    		my_s = new rs<T, Leaf>;
+            my_s->lo = lo;
+            my_s->hi = hi;
             my_s->result.store(not_set_status);
-            my_s->more_than_one_base = T();
             my_s->more_than_one_base.store(false);
-    		node<T>* n = new_range_base(b, lo, hi, my_s); // new range base with updated result storage
+            my_s->parallel = !cuts.empty();
+    		base_t* n = new_range_base(b, my_s); // new range base with updated result storage
 
     		if(!try_replace(t, b, n)) {
+                free_node(n);
+                release_storage(my_s);
                 goto find_first; // reset range query
             }
+            Reclaimer::retire(b, free_node);
+            Reclaimer::retire(my_s, release_storage); // our own reference, dropped after the query
     		replace_top(&s, n);
-    	} else if(b->type == range && b->hi >= hi) { // expand range query
-    		return all_in_range(t, b->lo, b->hi, b->storage);
+            b = n;
+    	} else if(b->type == range && !b->storage->parallel && b->storage->txn == NULL &&
+                  !Leaf::less(b->storage->hi, hi)) { // expand range query
+    		return all_in_range(t, b->storage->lo, b->storage->hi, b->storage);
     	} else {
     		help_if_needed(t, b);
     		goto find_first;
     	}
 
-    	stack<T> done;
-        done = stack<T>();
-        done.stack_lib = new std::stack<node<T>*>(); // stack_reset
-        done.stack_array = new std::vector<node<T>*>();
-    	while(true) { // Find remaining base nodes
-	    	push(&done, b); // ultimate final result stack (NOT the route nodes)
-	    	backup_s = copy_state(&s);
+    	stack<T, Leaf> done; // base nodes in the range, lowest first
+        if(cuts.empty()) {
+            if(!collect_rest(t, hi, my_s, b, &s, &done)) return my_s;
+        } else if(!collect_parallel(t, hi, my_s, b, &s, cuts, &done)) {
+            if((&my_s->result)->load() == aborted_range_status) return all_in_range(t, lo, hi, NULL); // retry alone
+            return my_s;
+        }
+
+    	range_leaves<T, Leaf>* res = new range_leaves<T, Leaf>(); // the leaves are shared, not copied
+        res->leaves.reserve(done.size);
+    	for(int i = 0; i < done.size; i++)
+            res->leaves.push_back(Leaf::retain(static_cast<base_t*>(done.items[i])->data));
+
+        range_leaves<T, Leaf>* expected = not_set_status;
+        if((&my_s->result)->compare_exchange_strong(expected, res, // if still not set by another thread, replace
+        std::memory_order_release, std::memory_order_relaxed)) { // && done.size > 1) {
+    	    (&my_s->more_than_one_base)->store(true);
+        } else {
+            range_result<T, Leaf>::release_leaves(res);
+            if(expected == aborted_range_status) return all_in_range(t, lo, hi, NULL); // retry alone
+        }
 
-            std::vector<int>::iterator it; // get maximum value
-            it = max_element(b->data->begin(), b->data->end());
+    	adapt_if_needed(t, static_cast<base_t*>(done.items[xorshift::local().next() % done.size]));
+    	return my_s;
+    }
 
-	    	if (!b->data->empty() && *it >= hi) {
-				break;
+    // Multi-key Update
+    // Claims the base nodes holding the keys of s's update, in key order, by
+    // turning them into range bases of s, then commits the update by setting
+    // the result of s. Run by the updating thread and by threads it blocks.
+    // Claiming in key order keeps helpers from waiting on each other in a
+    // cycle, as with range queries.
+    void claim_all(lfcat<T, Leaf>* t, rs<T, Leaf>* s) {
+        txn_t* x = s->txn;
+        for(size_t i = 0; i < x->ops.size(); i++) {
+            typename txn_t::op* o = &x->ops[i];
+            while((&o->claim)->load() == NULL) {
+                base_t* b = find_base_node((&t->root)->load(), o->key);
+                base_t* unclaimed = NULL;
+                if((&s->result)->load() != not_set_status) { // committed by another thread
+                    return;
+                } else if(b->type == range && b->storage == s) { // claimed for an earlier key
+                    (&o->claim)->compare_exchange_strong(unclaimed, b);
+                } else if(is_replaceable(b)) {
+                    base_t* n = new_range_base(b, s);
+                    if(try_replace(t, b, n)) {
+                        Reclaimer::retire(b, free_node);
+                        (&o->claim)->compare_exchange_strong(unclaimed, n);
+                    } else {
+                        free_node(n);
+                    }
+                } else {
+                    help_if_needed(t, b);
+                }
             }
-	    	find_next_base_node: b = find_next_base_stack(&s);
-	    	if(b == NULL) {
-                break; // out of base nodes
+        }
+        // Values moved by 'm' are read from their claimed base nodes before
+        // the commit, after which those may be installed and freed.
+        for(size_t i = 0; i < x->ops.size(); i++) {
+            typename txn_t::op* o = &x->ops[i];
+            if(o->mode != 'm' || (&o->moved)->load() != NULL) continue;
+            typename txn_t::op* src = &x->ops[o->src];
+            const V* v = Leaf::find((&src->claim)->load()->data, src->key);
+            typename txn_t::moved_value* mv = new typename txn_t::moved_value();
+            mv->found = v != NULL;
+            if(v != NULL) mv->value = *v;
+            typename txn_t::moved_value* unset = NULL;
+            if(!(&o->moved)->compare_exchange_strong(unset, mv)) delete mv;
+        }
+        range_leaves<T, Leaf>* expected = not_set_status;
+        (&s->result)->compare_exchange_strong(expected, committed_status);
+        init_txn_ts(x);
+    }
+
+    // Multi-key Update || Snapshot
+    // Stamps a committed update, which takes effect for snapshots then.
+    unsigned long long init_txn_ts(txn_t* x) {
+        unsigned long long ts = (&x->ts)->load();
+        if(ts != TS_UNSET) return ts;
+        (&x->ts)->compare_exchange_strong(ts, (&snapshot_clock::now())->load());
+        return (&x->ts)->load();
+    }
+
+    // Multi-key Update
+    // b's leaf with the operations of its committed update that b holds the
+    // keys of applied. Returns a new reference.
+    typename Leaf::type pending_leaf(base_t* b) {
+        txn_t* x = b->storage->txn;
+        typename Leaf::type l = Leaf::retain(b->data);
+        for(size_t i = 0; i < x->ops.size(); i++) {
+            typename txn_t::op* o = &x->ops[i];
+            if((&o->claim)->load() != b) continue;
+            bool res;
+            typename Leaf::type n;
+            if(o->mode == 'm') {
+                typename txn_t::moved_value* mv = (&o->moved)->load();
+                if(!mv->found) continue;
+                n = Leaf::insert(l, o->key, mv->value, true, &res);
+            } else if(o->mode == 'r') {
+                n = Leaf::remove(l, o->key, &res);
+            } else {
+                n = Leaf::insert(l, o->key, o->value, o->mode == 'p', &res);
             }
-	    	else if ((&my_s->result)->load() != not_set_status) { // range query is finished
-	    		return (&my_s->result)->load();
-	    	} else if (b->type == range && b->storage == my_s) { // b's storage is the same as the current
-	    		continue;
-	    	} else if (is_replaceable(b)) {
-	    		node<T>* n = new_range_base(b, lo, hi, my_s); // change the type of node b is
-	    		if(try_replace(t, b, n)) {
-	    			replace_top(&s, n);
-                    continue;
-	    		} else {
-	    			s = copy_state(&backup_s); // reset the stack
-	    			goto find_next_base_node;
-	    		}
-	    	} else { // another thread has intercepted; help it out
-	    		help_if_needed(t, b);
-	    		s = copy_state(&backup_s); // reset stack
-	    		goto find_next_base_node;
-	    	}
-    	}
+            Leaf::release(l);
+            l = n;
+        }
+        return l;
+    }
 
-    	std::vector<T>* res = done.stack_array->at(0)->data; // stack array is just an array of nodes
-    	for(int i = 1; i < done.stack_array->size(); i++)
-    		res = vector_join(res, done.stack_array->at(i)->data); // join all the data in the base nodes together
+    // Multi-key Update
+    // Replaces b, a range base of a committed update, with a normal base
+    // node holding the update's changes. Run by the updating thread for each
+    // base node it claimed and by any thread that finds one first.
+    void install(lfcat<T, Leaf>* t, base_t* b) {
+        base_t* n = new base_t(normal);
+        n->data = pending_leaf(b);
+        n->stat = b->stat;
+        n->parent = b->parent;
+        (&n->ts)->store(init_txn_ts(b->storage->txn)); // stamped as the update
+        n->prev = b;
+        if(try_replace(t, b, n)) {
+            Reclaimer::retire(b, free_base); // frees the leaf from before the update
+        } else {
+            free_base(n); // installed by another thread
+        }
+    }
 
-        if((&my_s->result)->compare_exchange_weak(not_set_status, res, // if still not set by another thread, replace
-        std::memory_order_release, std::memory_order_relaxed)) { // && done.stack_lib->size() > 1) {
-    	    (&my_s->more_than_one_base)->store(true);
+    // Lookup || Navigation
+    // The leaf readers see in b. Until it is installed, a base node claimed
+    // by a committed update still holds its leaf from before the update, so
+    // readers get the update applied to a copy, which they release.
+    // Stamps what it reads so snapshots taken later see it.
+    typename Leaf::type read_leaf(base_t* b, bool* copied) {
+        init_ts(b);
+        *copied = b->type == range && b->storage->txn != NULL &&
+                  (&b->storage->result)->load() == committed_status;
+        if(*copied) init_txn_ts(b->storage->txn);
+        return *copied ? pending_leaf(b) : b->data;
+    }
+
+    // Multi-key Update
+    // Claims, commits and installs the update x, then sets the result of
+    // each of its operations. Must run inside a guard, which also keeps x
+    // readable until the caller's guard ends.
+    void do_multi_update(lfcat<T, Leaf>* t, txn_t* x) {
+        rs<T, Leaf>* s = new rs<T, Leaf>;
+        s->lo = x->ops.front().key;
+        s->hi = x->ops.back().key;
+        s->result.store(not_set_status);
+        s->txn = x; // freed with s
+        claim_all(t, s);
+        for(size_t i = 0; i < x->ops.size(); i++) {
+            base_t* b = (&x->ops[i].claim)->load();
+            if(i == 0 || b != (&x->ops[i - 1].claim)->load()) install(t, b); // keys of one base node are adjacent
         }
+        for(size_t i = 0; i < x->ops.size(); i++) { // the claimed leaves are the state before the update
+            typename txn_t::op* o = &x->ops[i];
+            if(o->mode == 'm') o->result = (&o->moved)->load()->found;
+            else if(o->mode == 'r') o->result = Leaf::lookup((&o->claim)->load()->data, o->key);
+            else o->result = !Leaf::lookup((&o->claim)->load()->data, o->key);
+        }
+        Reclaimer::retire(s, release_storage); // our own reference
+    }
+
+    // Snapshot
+    // Stamps b with the clock unless it is stamped already. Versions are
+    // stamped after they are published but before anything reads or
+    // replaces them, so a version a snapshot cannot see was not seen by
+    // any operation that finished before the snapshot was taken.
+    void init_ts(base_t* b) {
+        unsigned long long ts = (&b->ts)->load();
+        if(ts == TS_UNSET)
+            (&b->ts)->compare_exchange_strong(ts, (&snapshot_clock::now())->load());
+    }
+
+    // Snapshot
+    // n replaces b with different entries. It is stamped by init_ts once
+    // published; b is stamped first so versions only get newer.
+    void new_version(base_t* n, base_t* b) {
+        init_ts(b);
+        (&n->ts)->store(TS_UNSET);
+        n->prev = b;
+    }
+
+    // Snapshot
+    // n holds the same entries as b, or some of them after a split, and so
+    // shares its timestamp.
+    void copy_version(base_t* n, base_t* b) {
+        init_ts(b);
+        (&n->ts)->store((&b->ts)->load());
+        n->prev = b;
+    }
+
+    // Snapshot
+    // n2 joins the entries of left and right, which are both stamped.
+    void join_version(base_t* n2, base_t* left, base_t* right) {
+        unsigned long long l = (&left->ts)->load(), r = (&right->ts)->load();
+        (&n2->ts)->store(l > r ? l : r);
+        n2->prev = left;
+        n2->joined = right;
+    }
 
-    	adapt_if_needed(t, done.stack_array->at(rand() % done.stack_array->size()));
-    	return (&my_s->result)->load();
+    // Snapshot
+    // Calls f(key, value) for the entries in [*lo, *hi) of l. A NULL bound
+    // is open.
+    template <class F>
+    void visit_interval(typename Leaf::type l, const T* lo, const T* hi, F& f) {
+        if(Leaf::size(l) == 0) return;
+        T a = lo != NULL ? *lo : Leaf::min(l);
+        T b;
+        if(hi == NULL) b = Leaf::max(l);
+        else if(!Leaf::prev(l, *hi, &b, NULL)) return;
+        if(!Leaf::less(b, a)) Leaf::visit_range(l, a, b, f);
+    }
+
+    // Snapshot
+    // Whether v is a range base claimed by an update that committed no
+    // later than snap but is not installed yet.
+    bool committed_by(base_t* v, unsigned long long snap) {
+        return v->type == range && v->storage->txn != NULL &&
+               (&v->storage->result)->load() == committed_status &&
+               init_txn_ts(v->storage->txn) <= snap;
+    }
+
+    // Snapshot
+    // Follows v back to the newest version that snap can see, or to a join
+    // made after snap, whose halves are followed separately. After a split
+    // the chains of all the new base nodes lead back through the same older
+    // versions, so each version passed is remembered in found with where it
+    // led, and later calls skip ahead.
+    base_t* snapshot_version(base_t* v, unsigned long long snap, version_map& found) {
+        base_t* r = v;
+        while(true) {
+            typename version_map::iterator it = found.find(r);
+            if(it != found.end()) {
+                r = it->second;
+                break;
+            }
+            init_ts(r);
+            if(committed_by(r, snap) || (&r->ts)->load() <= snap ||
+               (r->type == normal && r->joined != NULL)) break;
+            r = r->prev; // never NULL, versions without one are stamped 0
+        }
+        for(base_t* p = v; p != r && found.find(p) == found.end(); p = p->prev) found[p] = r;
+        return r;
+    }
+
+    // Snapshot
+    // Calls f for the entries in [*lo, *hi) of the newest version of v, or
+    // of those it replaced, stamped no later than snap. The versions older
+    // than v that this reaches were unlinked after the snapshot was taken,
+    // so the snapshot's guard keeps them alive.
+    template <class F>
+    void visit_version(base_t* v, const T* lo, const T* hi, unsigned long long snap, version_map& found, F& f) {
+        if(lo != NULL && hi != NULL && !Leaf::less(*lo, *hi)) return; // a join half outside the interval
+        v = snapshot_version(v, snap, found);
+        if(committed_by(v, snap)) { // committed before the snapshot but not installed
+            typename Leaf::type l = pending_leaf(v);
+            visit_interval(l, lo, hi, f);
+            Leaf::release(l);
+        } else if((&v->ts)->load() <= snap) {
+            visit_interval(v->data, lo, hi, f);
+        } else { // the halves meet at the key of the main node's old parent
+            base_t* main = v->prev->type == joinmain ? v->prev : v->joined;
+            T key = main->parent->key;
+            visit_version(v->prev, lo, hi != NULL && Leaf::less(*hi, key) ? hi : &key, snap, found, f);
+            visit_version(v->joined, lo != NULL && Leaf::less(key, *lo) ? lo : &key, hi, snap, found, f);
+        }
     }
 
     // Adaptations
-    node<T>* deep_copy(node<T>* b) {
-        node<T>* a = new node<T>();
+    // Copies the base node fields; join and range state is set by the caller.
+    base_t* deep_copy(base_t* b, node_type type) {
+        base_t* a = new base_t(type);
         a->data = b->data;
         a->stat = b->stat;
         a->parent = b->parent;
-        a->lo = b->lo; a->hi = b->hi;
-        a->storage = b->storage;
-        a->neigh1 = b->neigh1;
-        a->gparent = b->gparent;
-        a->otherb = b->otherb;
-        a->main_node = b->main_node;
-
-        node<T>* neigh2 = b->neigh2.load(); // cant copy atomics
-        (&a->neigh2)->store(neigh2);
-
+        copy_version(a, b);
         return a;
     }
 
     // Adaptations
-    node<T>* leftmost(node<T>* n) {
+    base_t* leftmost(node_t* n) {
         while (n->type == route) {
-            n = (&n->left)->load();
+            n = (&static_cast<route_t*>(n)->left)->load();
         }
-        return n;
+        return static_cast<base_t*>(n);
     }
 
     // Adaptations
-    node<T>* rightmost(node<T>* n) {
+    base_t* rightmost(node_t* n) {
         while (n->type == route) {
-            n = (&n->right)->load();
+            n = (&static_cast<route_t*>(n)->right)->load();
         }
-        return n;
+        return static_cast<base_t*>(n);
     }
 
     // Adaptations
-    node<T>* parent_of(lfcat<T>* t, node<T>* n) {
-        node<T>* prev_node = NULL;
-        node<T>* curr_node = (&t->root)->load();
+    // The parent of route node n. Read off the search path that found a base
+    // node below n when there is one, otherwise searched for from the root.
+    // A route node only gets a new parent when its parent is spliced out by
+    // a join, and a spliced out node keeps its join id, so a stale parent
+    // from the path makes the join fail to claim it and abort.
+    route_t* parent_of(lfcat<T, Leaf>* t, route_t* n, stack<T, Leaf>* path) {
+        if(path != NULL && path->size >= 2 && path->items[path->size - 2] == n)
+            return path->size >= 3 ? static_cast<route_t*>(path->items[path->size - 3]) : NULL;
+
+        route_t* prev_node = NULL;
+        node_t* curr_node = (&t->root)->load();
 
         while(curr_node != n && curr_node->type == route) {
-            prev_node = curr_node;
-            if(n->key < curr_node->key) {
-                curr_node = (&curr_node->left)->load();
+            prev_node = static_cast<route_t*>(curr_node);
+            if(Leaf::less(n->key, prev_node->key)) {
+                curr_node = (&prev_node->left)->load();
             } else {
-                curr_node = (&curr_node->right)->load();
+                curr_node = (&prev_node->right)->load();
             }
         }
 
@@ -532,63 +1466,89 @@ class lfcatree {
     // The first phase of the join as described by the paper. Other threads
     // cannot help with this process. The corresponding diagrams are marked
     // on their place in the code.
-    node<T>* secure_join_left(lfcat<T>* t, node<T>* b) {
-        node<T>* n0 = leftmost((&b->parent->right)->load()); // get the neighboring node on the right
-        if(!is_replaceable(n0)) return NULL;
+    base_t* secure_join_left(lfcat<T, Leaf>* t, base_t* b, stack<T, Leaf>* path) {
+        base_t* n0 = leftmost((&b->parent->right)->load()); // get the neighboring node on the right
+        if(!is_replaceable(n0)) {
+            STAT_INC(stat_join_abort);
+            return NULL;
+        }
+        if(Leaf::size(b->data) + Leaf::size(n0->data) > adaptation.max_leaf_size) return NULL; // would be split again
 
-        node<T>* m = deep_copy(b); // m is the main node
-        m->type = joinmain; // mark that it is part of a join
+        base_t* m = deep_copy(b, joinmain); // m is the main node, marked as part of a join
+        join_t* join = new join_t();
+        join->main_node = m;
+        m->join = join;
 
-        node<T>* nullvalue = nullptr;
+        base_t* nullvalue = nullptr;
 
-        if(!(b->parent->left.compare_exchange_weak(b, m, // check that it's still on the left side and replace it (b)
-        std::memory_order_release, std::memory_order_relaxed))) // cas
+        node_t* expected = b;
+        if(!(b->parent->left.compare_exchange_strong(expected, m, // check that it's still on the left side and replace it (b)
+        std::memory_order_release, std::memory_order_relaxed))) { // cas
+            delete join;
+            delete m; // never published
+            STAT_INC(stat_join_abort);
             return NULL;
+        }
+        Reclaimer::retire(b, free_node); // m took over b's leaf
 
-        node<T>* n1 = deep_copy(n0);
-        n1->main_node = m; // copy the neighboring node to replace it and change its type to join (c)
+        base_t* n1 = deep_copy(n0, joinneighbor);
+        n1->join = join; // copy the neighboring node to replace it and change its type to join (c)
 
         if(!try_replace(t, n0, n1)) { // replace the neighboring node
-    		(&m->neigh2)->store(aborted_status);
+            (&join->refs)->fetch_sub(1);
+            delete n1; // never published
+    		(&join->neigh2)->store(aborted_status);
+            STAT_INC(stat_join_abort);
             return NULL;
-        } else if(!(m->parent->join_id.compare_exchange_weak(nullvalue, m, // cas
+        }
+        Reclaimer::retire(n0, free_node); // n1 took over n0's leaf
+        if(!(m->parent->join_id.compare_exchange_strong(nullvalue, m, // cas
         std::memory_order_release, std::memory_order_relaxed))) { // check that another thread has not attatched
                                                                 // a join id and if not, set it (d)
-    		(&m->neigh2)->store(aborted_status);
+    		(&join->neigh2)->store(aborted_status);
+            STAT_INC(stat_join_abort);
             return NULL;
         }
 
-        node<T>* gparent = parent_of(t, m->parent); // set the join ids of the parents and grandparents to
+        route_t* gparent = parent_of(t, m->parent, path); // set the join ids of the parents and grandparents to
                                                     // indicate that it is part of a join
+        nullvalue = NULL;
         if(gparent == NOT_FOUND ||
           (gparent != NULL &&
-           !(gparent->join_id.compare_exchange_weak(nullvalue, m, // cas
+           !(gparent->join_id.compare_exchange_strong(nullvalue, m, // cas
            std::memory_order_release, std::memory_order_relaxed)))) {
     		(&m->parent->join_id)->store(NULL);
+    		(&join->neigh2)->store(aborted_status); // otherwise m stays unreplaceable
+            STAT_INC(stat_join_abort);
             return NULL;
         }
 
-        m->gparent = gparent; // set the information used for complete_join
-        m->otherb = (&m->parent->right)->load(); // set to the actual value of right neighbor
-        m->neigh1 = n1; // set to the expected value of the right neighbor
+        join->gparent = gparent; // set the information used for complete_join
+        join->otherb = (&m->parent->right)->load(); // set to the actual value of right neighbor
+        join->neigh1 = n1; // set to the expected value of the right neighbor
 
-        node<T>* joinedp = m->otherb==n1 ? gparent: n1->parent; // set the main node's neigh2 field to n2, which
+        route_t* joinedp = join->otherb==n1 ? gparent: n1->parent; // set the main node's neigh2 field to n2, which
                                                                 // will eventually replace both m and n1 in the
                                                                 // complete_join (e)
-        node<T>* n2 = deep_copy(n1);
+        base_t* n2 = deep_copy(n1, normal);
         n2->parent = joinedp;
-        n2->main_node = m;
-        n2->data = vector_join(m->data, n1->data);
+        n2->data = Leaf::join(m->data, n1->data); // m is on the left
+        join_version(n2, m, n1);
+
+        base_t* preparing = preparing_status;
 
-        if(m->neigh2.compare_exchange_weak(preparing_status, n2,
+        if(join->neigh2.compare_exchange_strong(preparing, n2,
           std::memory_order_release, std::memory_order_relaxed)) return m; // should end here if CAS is successful
+        free_base(n2); // the join was aborted by a helper
 
         if(gparent == NULL) {
     		(&m->parent->join_id)->store(NULL);
+            STAT_INC(stat_join_abort);
             return NULL;
         }
     	(&gparent->join_id)->store(NULL);
 
+        STAT_INC(stat_join_abort);
         return NULL;
     }
 
@@ -596,289 +1556,385 @@ class lfcatree {
     // The first phase of the join as described by the paper. Other threads
     // cannot help with this process. The corresponding diagrams are marked
     // on their place in the code.
-    node<T>* secure_join_right(lfcat<T>* t, node<T>* b) {
-        node<T>* n0 = rightmost((&b->parent->left)->load()); // get the neighboring node on the left
-        if(!is_replaceable(n0)) return NULL;
+    base_t* secure_join_right(lfcat<T, Leaf>* t, base_t* b, stack<T, Leaf>* path) {
+        base_t* n0 = rightmost((&b->parent->left)->load()); // get the neighboring node on the left
+        if(!is_replaceable(n0)) {
+            STAT_INC(stat_join_abort);
+            return NULL;
+        }
+        if(Leaf::size(b->data) + Leaf::size(n0->data) > adaptation.max_leaf_size) return NULL; // would be split again
 
-        node<T>* m = deep_copy(b); // m is the main node
-        m->type = joinmain; // mark that it is part of a join
+        base_t* m = deep_copy(b, joinmain); // m is the main node, marked as part of a join
+        join_t* join = new join_t();
+        join->main_node = m;
+        m->join = join;
 
-        node<T>* nullvalue = nullptr;
+        base_t* nullvalue = nullptr;
 
-        if(!(b->parent->right.compare_exchange_weak(b, m,
-          std::memory_order_release, std::memory_order_relaxed))) return NULL;
+        node_t* expected = b;
+        if(!(b->parent->right.compare_exchange_strong(expected, m,
+          std::memory_order_release, std::memory_order_relaxed))) {
+            delete join;
+            delete m; // never published
+            STAT_INC(stat_join_abort);
+            return NULL;
+        }
+        Reclaimer::retire(b, free_node); // m took over b's leaf
 
-        node<T>* n1 = deep_copy(n0);
-        n1->main_node = m; // copy the neighboring node to replace it and change its type to join (c)
+        base_t* n1 = deep_copy(n0, joinneighbor);
+        n1->join = join; // copy the neighboring node to replace it and change its type to join (c)
 
         if(!try_replace(t, n0, n1)) { // replace the neighboring node
-    		(&m->neigh2)->store(aborted_status);
+            (&join->refs)->fetch_sub(1);
+            delete n1; // never published
+    		(&join->neigh2)->store(aborted_status);
+            STAT_INC(stat_join_abort);
             return NULL;
-        } else if(!(m->parent->join_id.compare_exchange_weak(nullvalue, m,
+        }
+        Reclaimer::retire(n0, free_node); // n1 took over n0's leaf
+        if(!(m->parent->join_id.compare_exchange_strong(nullvalue, m,
                  std::memory_order_release, std::memory_order_relaxed))) { // check that another thread has not attatched
                                                                           // a join id and if not, set it (d)
-    		(&m->neigh2)->store(aborted_status);
+    		(&join->neigh2)->store(aborted_status);
+            STAT_INC(stat_join_abort);
             return NULL;
         }
 
-        node<T>* gparent = parent_of(t, m->parent); // set the join ids of the parents and grandparents to
+        route_t* gparent = parent_of(t, m->parent, path); // set the join ids of the parents and grandparents to
                                                     // indicate that it is part of a join
+        nullvalue = NULL;
         if(gparent == NOT_FOUND ||
           (gparent != NULL &&
-           !(gparent->join_id.compare_exchange_weak(nullvalue, m,
+           !(gparent->join_id.compare_exchange_strong(nullvalue, m,
            std::memory_order_release, std::memory_order_relaxed)))) {
     		(&m->parent->join_id)->store(NULL);
+    		(&join->neigh2)->store(aborted_status); // otherwise m stays unreplaceable
+            STAT_INC(stat_join_abort);
             return NULL;
         }
 
-        m->gparent = gparent; // set the information used for complete_join
-        m->otherb = (&m->parent->left)->load(); // set to the actual value of left neighbor
-        m->neigh1 = n1; // set to the expected value of the left neighbor
+        join->gparent = gparent; // set the information used for complete_join
+        join->otherb = (&m->parent->left)->load(); // set to the actual value of left neighbor
+        join->neigh1 = n1; // set to the expected value of the left neighbor
 
-        node<T>* joinedp = m->otherb==n1 ? gparent: n1->parent; // set the main node's neigh2 field to n2, which
+        route_t* joinedp = join->otherb==n1 ? gparent: n1->parent; // set the main node's neigh2 field to n2, which
                                                                 // will eventually replace both m and n1 in the
                                                                 // complete_join (e)
-        node<T>* n2 = deep_copy(n1);
+        base_t* n2 = deep_copy(n1, normal);
         n2->parent = joinedp;
-        n2->main_node = m;
-        n2->data = vector_join(m->data, n1->data);
+        n2->data = Leaf::join(n1->data, m->data); // m is on the right
+        join_version(n2, n1, m);
+
+        base_t* preparing = preparing_status;
 
-        if(m->neigh2.compare_exchange_weak(preparing_status, n2, // should end here if CAS is successful
+        if(join->neigh2.compare_exchange_strong(preparing, n2, // should end here if CAS is successful
             std::memory_order_release, std::memory_order_relaxed)) return m;
+        free_base(n2); // the join was aborted by a helper
 
         if(gparent == NULL) {
     		(&m->parent->join_id)->store(NULL);
+            STAT_INC(stat_join_abort);
             return NULL;
         }
         (&gparent->join_id)->store(NULL);
 
+        STAT_INC(stat_join_abort);
         return NULL;
     }
 
     // Adaptation
     // The second part of the join. Multiple threads can help out this
     // part of the join.
-    void complete_join(lfcat<T>* t, node<T>* m) {
-        node<T>* n2 = (&m->neigh2)->load();
+    void complete_join(lfcat<T, Leaf>* t, base_t* m) {
+        join_t* join = m->join;
+        base_t* n2 = (&join->neigh2)->load();
 
         if(n2 == done_status) return;
 
-        try_replace(t, m->neigh1, n2); // replace the neighbor node (f)
+        if(try_replace(t, join->neigh1, n2)) // replace the neighbor node (f)
+            Reclaimer::retire(join->neigh1, free_base);
     	(&m->parent->valid)->store(false); // mark the main node's parent as false to prevent other threads from
                                           // traversing to it
-        node<T>* replacement = (m->otherb == m->neigh1) ? n2 : m->otherb; // check that the neighbor node that was
+        node_t* replacement = (join->otherb == join->neigh1) ? n2 : join->otherb; // check that the neighbor node that was
                                                                           // replaced wasn't changed by another thread
-        if (m->gparent == NULL) { // parent is spliced out in the following condition statements (g)
-            (&t->root)->compare_exchange_weak(m->parent, replacement, // replacement is the node with the merged data
+        route_t* gparent = join->gparent;
+        node_t* parent = m->parent;
+        base_t* joiner = m;
+        bool spliced = false;
+        if (gparent == NULL) { // parent is spliced out in the following condition statements (g)
+            spliced = (&t->root)->compare_exchange_strong(parent, replacement, // replacement is the node with the merged data
              std::memory_order_release, std::memory_order_relaxed);
-        } else if((&m->gparent->left)->load() == m->parent) {
-            (&m->gparent->left)->compare_exchange_weak(m->parent, replacement,
+        } else if((&gparent->left)->load() == m->parent) {
+            spliced = (&gparent->left)->compare_exchange_strong(parent, replacement,
              std::memory_order_release, std::memory_order_relaxed);
 
-            (&m->gparent->join_id)->compare_exchange_weak(m, NULL,
+            (&gparent->join_id)->compare_exchange_strong(joiner, NULL,
              std::memory_order_release, std::memory_order_relaxed);
-        } else if((&m->gparent->right)->load() == m->parent) {
-            (&m->gparent->right)->compare_exchange_weak(m->parent, replacement,
+        } else if((&gparent->right)->load() == m->parent) {
+            spliced = (&gparent->right)->compare_exchange_strong(parent, replacement,
              std::memory_order_release, std::memory_order_relaxed);
 
-            (&m->gparent->join_id)->compare_exchange_weak(m, NULL,
+            (&gparent->join_id)->compare_exchange_strong(joiner, NULL,
              std::memory_order_release, std::memory_order_relaxed);
         }
-    	(&m->neigh2)->store(done_status); // n2 is now marked as replacable and the join has been completed (h)
+        if(spliced) { // the route node and m are no longer reachable
+            Reclaimer::retire(m->parent, free_node);
+            Reclaimer::retire(m, free_base);
+        }
+    	(&join->neigh2)->store(done_status); // n2 is now marked as replacable and the join has been completed (h)
     }
 
     // Adaptations
     // Join the contents of two base nodes into one base node
-    void low_contention_adaptation(lfcat<T>* t, node<T>* b) {
+    void low_contention_adaptation(lfcat<T, Leaf>* t, base_t* b, stack<T, Leaf>* path) {
         if(b->parent == NULL) return;
         if((&b->parent->left)->load() == b) { // check what side the node is on
-            node<T>* m = secure_join_left(t, b);
-            if (m != NULL) complete_join(t, m);
+            base_t* m = secure_join_left(t, b, path);
+            if (m != NULL) {
+                STAT_INC(stat_join);
+                complete_join(t, m);
+            }
         } else if ((&b->parent->right)->load() == b) { // check what side the node is on
-            node<T>* m = secure_join_right(t, b);
-            if (m != NULL) complete_join(t, m);
+            base_t* m = secure_join_right(t, b, path);
+            if (m != NULL) {
+                STAT_INC(stat_join);
+                complete_join(t, m);
+            }
         }
     }
 
     // Adaptations
-    // Split the contents of one base node into two base nodes
-    void high_contention_adaptation(lfcat<T>* m, node<T>* b) {
-        if(b->data->size() < 2) return;
-
-        std::vector<T>* data = b->data;
-        std::sort(data->begin(), data->end());
-
-        node<T>* r = new node<T>(); // create new route node to hold two new base nodes
-        r->type = route;
-        r->key = split_key(data);
-        r->valid = true;
-
-        node<T>* left = new node<T>();
-        left->type = normal;
-        left->parent = r;
-        left->stat = 0;
-        left->data = split_left(data, r->key);
-        r->left = left;
-
-        node<T>* right = new node<T>();
-        right->type = normal;
-        right->parent = r;
-        right->stat = 0;
-        right->data = split_right(data, r->key);
-        r->right = right;
-
-        try_replace(m, b, r);
-    }
-
-    //=== Test Functions ================================
-    node<T>* new_route_node(T key) {
-        node<T>* r = new node<T>();
-        r->key = key;
-        r->type = route;
-        return r;
-    }
-
-    node<T>* new_base_node(std::vector<T>* data) {
-        node<T>* b = new node<T>();
-        b->data = data;
-        b->type = normal;
-        return b;
-    }
-
-    void test() {
-        node<T>* r0 = new_route_node(70); // fill the lfca tree with data
-        node<T>* r1 = new_route_node(40);
-        node<T>* r2 = new_route_node(80);
-        node<T>* r3 = new_route_node(60);
-
-        std::vector<int>* r1_ldata = new std::vector<int>{35, 36, 37};
-        std::vector<int>* r2_ldata = new std::vector<int>{75, 76, 77};
-        std::vector<int>* r2_rdata = new std::vector<int>{85, 86, 87};
-        std::vector<int>* r3_ldata = new std::vector<int>{55, 56, 57};
-        std::vector<int>* r3_rdata = new std::vector<int>{65, 66, 67};
-
-        node<T>* r1_lbase = new_base_node(r1_ldata);
-        node<T>* r2_lbase = new_base_node(r2_ldata);
-        node<T>* r2_rbase = new_base_node(r2_rdata);
-        node<T>* r3_lbase = new_base_node(r3_ldata);
-        node<T>* r3_rbase = new_base_node(r3_rdata);
-
-        r0->left = r1;
-        r0->right = r2;
-
-        r1->parent = r0;
-        r1->left = r1_lbase;
-        r1->right = r3;
-
-        r2->parent = r0;
-        r2->left = r2_lbase;
-        r2->right = r2_rbase;
-
-        r3->parent = r1;
-        r3->left = r3_lbase;
-        r3->right = r3_rbase;
-
-        r1_lbase->parent = r1;
-        r2_lbase->parent = r2;
-        r2_rbase->parent = r2;
-        r3_lbase->parent = r3;
-        r3_rbase->parent = r3;
-
-        lfcat<T>* tree = new lfcat<T>();
-        tree->root = r0;
-
-        pthread_t threads[NUM_THREADS];
-        struct arg_struct<T> args[NUM_THREADS];
-
-        // Insert
-        for (int i = 0; i < NUM_THREADS; i++) {
-            args[i].tid = i;
-            args[i].tree = tree;
-            args[i].self = this;
-            pthread_create(&threads[i], NULL, insert_test, (void *)&args[i]);
-        }
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_join(threads[i], NULL);
+    // Split the contents of one base node into k base nodes of nearly equal
+    // size under a balanced subtree of route nodes, installed with a single
+    // replacement. Small leaves split in two; large ones fan out into up to
+    // SPLIT_WAYS children of about SPLIT_LEAF_SIZE entries each. Leaves over
+    // the policy's max_leaf_size, as left by batch updates or bulk loading,
+    // fan out as far as it takes to bring every part under it. Leaves with
+    // fewer than twice the policy's min_leaf_size entries are not split.
+    void high_contention_adaptation(lfcat<T, Leaf>* m, base_t* b) {
+        size_t n = Leaf::size(b->data);
+        if(n < 2 || n < 2 * adaptation.min_leaf_size) return; // no part may fall below the minimum
+        size_t max = adaptation.max_leaf_size; // a copy, the limit may be a static constexpr
+        size_t part = max < SPLIT_LEAF_SIZE ? max : SPLIT_LEAF_SIZE;
+        if(part == 0) part = 1;
+        size_t k = n / part;
+        if(n > max) k = (n + part - 1) / part;
+        else if(k > SPLIT_WAYS) k = SPLIT_WAYS;
+        if(k < 2) k = 2;
+        while(k > 2 && k * adaptation.min_leaf_size > n) k--;
+
+        std::vector<typename Leaf::type> parts(k);
+        std::vector<base_t*> bases(k);
+        Leaf::split_n(b->data, k, &parts[0]);
+        for(size_t i = 0; i < k; i++) {
+            bases[i] = new base_t(normal);
+            bases[i]->stat = 0;
+            bases[i]->data = parts[i];
+            copy_version(bases[i], b); // same entries, so the same version
         }
+        node_t* r = bulk_skeleton(&bases[0], 0, k, b->parent);
 
-        // Lookups
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_create(&threads[i], NULL, lookup_test, (void *)&args[i]);
-        }
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_join(threads[i], NULL);
+        if(try_replace(m, b, r)) {
+            STAT_INC(stat_split);
+            Reclaimer::retire(b, free_base);
+        } else {
+            free_tree(r);
         }
+    }
 
-        // Range Queries
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_create(&threads[i], NULL, query_test, (void *)&args[i]);
-        }
-        for (int i = 0; i < NUM_THREADS; i++) {
-            pthread_join(threads[i], NULL);
-            printf("finished thread %d\n", i);
+    //=== Benchmark Functions ===========================
+    // Frees every node and leaf of a tree that no thread is using anymore.
+    static void free_tree(node_t* n) {
+        if(n == NULL) return;
+        if(n->type == route) {
+            free_tree((&static_cast<route_t*>(n)->left)->load());
+            free_tree((&static_cast<route_t*>(n)->right)->load());
+            free_node(n);
+        } else {
+            free_base(n);
         }
     }
 
-    static void *insert_test(void* args) {
-        struct arg_struct<T> *info = (struct arg_struct<T>*)args;
-        int tid = info->tid;
-        lfcat<T>* tree = info->tree;
-        void *self = info->self;
-
-        printf("starting insertion for thread %d\n", tid);
+    // A tree holding each key in [0, key_range) with probability 1/2.
+    lfcat<T, Leaf>* prefilled_tree(const bench_config* c, key_generator* rng) {
+        std::vector<T> keys;
+        for(int k = 0; k < c->key_range; k++) {
+            if(rng->next_random() & 1) keys.push_back(k);
+        }
+        return bulk_load(keys.begin(), keys.end(), c->leaf_size, std::thread::hardware_concurrency());
+    }
 
-        for(int i = 0; i < NUM_UPDATE; i++) {
-            static_cast <lfcatree<T>*>(self)->insert(tree, (tid * 10) + i);
+    static void *bench_worker(void* args) {
+        struct arg_struct<T, Leaf> *info = (struct arg_struct<T, Leaf>*)args;
+        lfcatree* self = static_cast <lfcatree*>(info->self);
+        lfcat<T, Leaf>* tree = info->tree;
+        const bench_config* c = info->config;
+        key_generator rng = *info->keys;
+        rng.seed(bench_seed(c, info->tid + 1));
+        xorshift::local().seed(bench_seed(c, info->tid + 1)); // adaptation sampling
+
+        unsigned long ops = 0;
+        unsigned long keys_read = 0;
+        while(!info->stop->load(std::memory_order_relaxed)) {
+            int key = rng.next();
+            int op = rng.next_random() % 100;
+            if(op < c->update_pct) {
+                if(op & 1) self->insert(tree, key);
+                else self->remove(tree, key);
+            } else if(op < c->update_pct + c->range_pct) {
+                range_result<T, Leaf> r = self->query(tree, key, key + c->range_size - 1);
+                r.for_each([&keys_read](const T&) { keys_read++; });
+            } else {
+                self->lookup(tree, key);
+            }
+            (&info->ops)->store(++ops, std::memory_order_relaxed);
         }
+        info->keys_read = keys_read;
         pthread_exit(NULL);
     }
 
-    static void *lookup_test(void* args) {
-        struct arg_struct<T> *info = (struct arg_struct<T>*)args;
-        int tid = info->tid;
-        lfcat<T>* tree = info->tree;
-        void *self = info->self;
-
-        printf("starting lookup for thread %d\n", tid);
+    // Seed of random stream `stream` of a run; stream 0 fills the tree and
+    // thread i draws from stream i + 1.
+    static unsigned long long bench_seed(const bench_config* c, int stream) {
+        return c->seed * 0x10000 + stream;
+    }
 
-        for(int i = 0; i < NUM_LOOKUP; i++) {
-            static_cast <lfcatree<T>*>(self)->lookup(tree, (tid * 10) + i);
-        }
-        pthread_exit(NULL);
+    static unsigned long total_ops(struct arg_struct<T, Leaf>* args, int n) {
+        unsigned long sum = 0;
+        for(int i = 0; i < n; i++) sum += (&args[i].ops)->load(std::memory_order_relaxed);
+        return sum;
     }
 
-    static void *query_test(void* args) {
-        struct arg_struct<T> *info = (struct arg_struct<T>*)args;
-        int tid = info->tid;
-        lfcat<T>* tree = info->tree;
-        void *self = info->self;
+    // Runs the configured workload once per thread count on a fresh tree and
+    // prints the throughput of the measurement window.
+    void benchmark(const bench_config* c) {
+        key_generator keys(c->key_range, c->zipf);
+        for(size_t t = 0; t < c->threads.size(); t++) {
+            int n = c->threads[t];
+            key_generator rng = keys;
+            rng.seed(bench_seed(c, 0)); // the same prefilled tree for every thread count
+            lfcat<T, Leaf>* tree = prefilled_tree(c, &rng);
+
+            std::vector<pthread_t> threads(n);
+            std::vector<struct arg_struct<T, Leaf> > args(n);
+            std::atomic<bool> stop(false);
+            for(int i = 0; i < n; i++) {
+                args[i].tid = i;
+                args[i].tree = tree;
+                args[i].self = this;
+                args[i].config = c;
+                args[i].keys = &keys;
+                args[i].stop = &stop;
+                (&args[i].ops)->store(0);
+                pthread_create(&threads[i], NULL, bench_worker, (void *)&args[i]);
+            }
 
-        printf("starting query for thread %d\n", tid);
+            usleep((useconds_t)(c->warmup * 1e6));
+#ifdef LFCAS_STATS
+            tree_stats s0 = stats();
+#endif
+            unsigned long ops0 = total_ops(&args[0], n);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            usleep((useconds_t)(c->duration * 1e6));
+            unsigned long ops1 = total_ops(&args[0], n);
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+#ifdef LFCAS_STATS
+            tree_stats s1 = stats();
+#endif
+
+            stop.store(true);
+            for (int i = 0; i < n; i++) {
+                pthread_join(threads[i], NULL);
+            }
 
-        for(int i = 0; i < NUM_QUERY; i++) {
-            static_cast <lfcatree<T>*>(self)->query(tree, (tid * 10), (tid * 10) + 9);
+            double secs = std::chrono::duration<double>(end - start).count();
+            printf("leaf=%s threads=%d update=%d%% range=%d%% keys=%d zipf=%.2f ops/s=%.0f",
+                   c->leaf.c_str(), n, c->update_pct, c->range_pct, c->key_range, c->zipf,
+                   (ops1 - ops0) / secs);
+#ifdef LFCAS_STATS
+            printf(" cas_failures=%lu helps=%lu splits=%lu joins=%lu join_aborts=%lu",
+                   s1.cas_failures - s0.cas_failures, s1.helps - s0.helps,
+                   s1.splits - s0.splits, s1.joins - s0.joins, s1.join_aborts - s0.join_aborts);
+#endif
+            printf("\n");
+            fflush(stdout);
+            destroy(tree);
         }
-        pthread_exit(NULL);
     }
+};
 
-   static void *remove_test(void* args) {
-        struct arg_struct<T> *info = (struct arg_struct<T>*)args;
-        int tid = info->tid;
-        lfcat<T>* tree = info->tree;
-        void *self = info->self;
-
-        printf("starting removal for thread %d\n", tid);
+// The benchmark program. Tests include this file with -DLFCAS_NO_MAIN.
+#ifndef LFCAS_NO_MAIN
+// Variants of the benchmark for measuring helping and adaptation, built
+// from this file with -DLFCAS_NO_HELPING and -DLFCAS_NO_ADAPTATION.
+#ifdef LFCAS_NO_HELPING
+typedef no_helping bench_helping;
+#else
+typedef helping bench_helping;
+#endif
+#ifdef LFCAS_NO_ADAPTATION
+typedef no_adaptation bench_adaptation;
+#else
+typedef default_adaptation bench_adaptation;
+#endif
+
+static void usage(const char* prog) {
+    fprintf(stderr,
+        "usage: %s [options]\n"
+        "  -t LIST   comma separated thread counts (default 1,2,4,8)\n"
+        "  -u PCT    updates, half inserts and half removes (default 20)\n"
+        "  -q PCT    range queries, the rest are lookups (default 0)\n"
+        "  -k N      key range [0, N) (default 100000)\n"
+        "  -r N      keys per range query (default 100)\n"
+        "  -l N      entries per base node of the prefilled tree (default 128)\n"
+        "  -z THETA  Zipf skew in [0, 1), 0 for uniform keys (default 0)\n"
+        "  -w SECS   warm-up time (default 1)\n"
+        "  -d SECS   measured time (default 5)\n"
+        "  -c LEAF   leaf container, treap or flat (default treap)\n"
+        "  -s SEED   random seed, runs with the same seed repeat (default 1)\n", prog);
+}
 
-        for(int i = 0; i < NUM_UPDATE; i++) {
-            static_cast <lfcatree<T>*>(self)->remove(tree, (tid * 10) + i);
+int main (int argc, char** argv) {
+    bench_config c;
+    std::string threads = "1,2,4,8";
+    int opt;
+    while((opt = getopt(argc, argv, "t:u:q:k:r:l:z:w:d:c:s:h")) != -1) {
+        switch(opt) {
+            case 't': threads = optarg; break;
+            case 'u': c.update_pct = atoi(optarg); break;
+            case 'q': c.range_pct = atoi(optarg); break;
+            case 'k': c.key_range = atoi(optarg); break;
+            case 'r': c.range_size = atoi(optarg); break;
+            case 'l': c.leaf_size = atoi(optarg); break;
+            case 'z': c.zipf = atof(optarg); break;
+            case 'w': c.warmup = atof(optarg); break;
+            case 'd': c.duration = atof(optarg); break;
+            case 'c': c.leaf = optarg; break;
+            case 's': c.seed = strtoull(optarg, NULL, 10); break;
+            default: usage(argv[0]); return 1;
         }
-        pthread_exit(NULL);
     }
-};
+    for(size_t pos = 0; pos < threads.size(); ) {
+        size_t comma = threads.find(',', pos);
+        if(comma == std::string::npos) comma = threads.size();
+        int n = atoi(threads.substr(pos, comma - pos).c_str());
+        if(n > 0) c.threads.push_back(n);
+        pos = comma + 1;
+    }
+    if(c.threads.empty() || c.update_pct < 0 || c.range_pct < 0 ||
+       c.update_pct + c.range_pct > 100 || c.key_range < 2 || c.range_size < 1 || c.leaf_size < 1 ||
+       c.zipf < 0 || c.zipf >= 1 || (c.leaf != "treap" && c.leaf != "flat")) {
+        usage(argv[0]);
+        return 1;
+    }
 
-int main () {
-    lfcatree<int> lfca;
-    lfca.test();
+    if(c.leaf == "flat") {
+        lfcatree<int, no_value, std::less<int>, flat_leaf, epoch_reclaimer, bench_adaptation, bench_helping> lfca;
+        lfca.benchmark(&c);
+    } else {
+        lfcatree<int, no_value, std::less<int>, treap_leaf, epoch_reclaimer, bench_adaptation, bench_helping> lfca;
+        lfca.benchmark(&c);
+    }
     return 0;
 }
-
+#endif
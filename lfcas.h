@@ -6,77 +6,497 @@
 #include <time.h>
 #include <unistd.h>
 #include <fstream>
-#include <stack>
 #include <atomic>
 #include <vector>
 #include <chrono>
 #include <set>
+#include <string>
+#include <cmath>
+#include <iterator>
+#include <unordered_map>
+#include <deque>
+#include <functional>
+#include <condition_variable>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "lfcas_reclaim.h"
+#include "lfcas_treap.h"
+#include "lfcas_flat.h"
+#include "lfcas_stats.h"
+#include "lfcas_adapt.h"
+#include "lfcas_pool.h"
 
 //=== Constants =====================================
-#define CONT_CONTRIB 250 // For adaptation
-#define LOW_CONT_CONTRIB 1 // ...
-#define RANGE_CONTRIB 100 // ...
-#define HIGH_CONT 1000 // ...
-#define LOW_CONT -1000 // ...
-#define NOT_FOUND (node<T>*)1 // Special pointers
-#define NUM_THREADS 10
-#define NUM_UPDATE 40
-#define NUM_LOOKUP 40
-#define NUM_QUERY 20
-enum contention_info { contended , uncontened , noinfo };
-enum node_type {
+#define NOT_FOUND (route_node<T, Leaf>*)1 // Special pointers
+#define NOT_SET (range_leaves<T, Leaf>*)1 // ...
+#define RANGE_ABORTED (range_leaves<T, Leaf>*)2 // Result of an aborted parallel range query
+#define TXN_COMMITTED (range_leaves<T, Leaf>*)3 // Result of a committed multi-key update
+#ifndef BULK_LEAF_SIZE
+#define BULK_LEAF_SIZE 128 // Entries per base node built by bulk_load
+#endif
+#ifndef SPLIT_WAYS
+#define SPLIT_WAYS 8 // Most base nodes one split of a leaf within the maximum size creates
+#endif
+#ifndef SPLIT_LEAF_SIZE
+#define SPLIT_LEAF_SIZE 64 // Entries per base node a multi-way split aims for
+#endif
+#ifndef PARALLEL_MIN_BASES
+#define PARALLEL_MIN_BASES 8 // Fewest base nodes per thread a parallel range query is cut into
+#endif
+#ifndef STACK_DEPTH
+#define STACK_DEPTH 64 // Route nodes a range query stack holds without allocating
+#endif
+#ifndef BACKOFF_MIN
+#define BACKOFF_MIN 16 // Most pauses before the first retry of a failed update
+#endif
+#ifndef BACKOFF_MAX
+#define BACKOFF_MAX 4096 // Most pauses before any retry
+#endif
+//=== Random Numbers ================================
+// xorshift64* generator (Vigna). Each thread draws from its own, so random
+// choices never contend on shared state the way rand() does.
+struct xorshift {
+    unsigned long long state;
+
+    xorshift(unsigned long long s = 1) { seed(s); }
+
+    void seed(unsigned long long s) {
+        state = s * 0x9e3779b97f4a7c15ULL + 1;
+        if(state == 0) state = 1; // zero is a fixed point
+    }
+
+    unsigned long long next() {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545f4914f6cdd1dULL;
+    }
+
+    // The calling thread's generator. Threads are seeded 1, 2, ... in the
+    // order they first use it; call seed on it for reproducible runs.
+    static xorshift& local() {
+        static std::atomic<unsigned long long> threads(0);
+        static thread_local xorshift rng(++threads);
+        return rng;
+    }
+};
+//=== Backoff =======================================
+// Bounded exponential backoff for updates that lost a race. Each wait spins
+// a random number of pauses below a limit that doubles from BACKOFF_MIN up
+// to BACKOFF_MAX, so threads that collided retry at different times.
+struct backoff {
+    unsigned long long limit;
+
+    backoff() : limit(BACKOFF_MIN) {}
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield");
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    void wait() {
+        unsigned long long n = xorshift::local().next() % limit + 1;
+        for(unsigned long long i = 0; i < n; i++) pause();
+        if(limit < BACKOFF_MAX) limit *= 2;
+    }
+};
+//=== Snapshot Clock ================================
+// Versions of base nodes are stamped with this clock and a snapshot at time
+// ts sees the versions stamped ts or earlier. Taking a snapshot advances the
+// clock, so writers only read it. Shared by all trees.
+#define TS_UNSET (~0ULL) // Timestamp of a version not stamped yet
+struct snapshot_clock {
+    static std::atomic<unsigned long long>& now() {
+        static std::atomic<unsigned long long> clock(1);
+        return clock;
+    }
+};
+//=== Dump Files ====================================
+// A dump file holds this header, the images of its leaves in key order,
+// each starting on a cache line, and an index of their offsets. The header
+// is written last, so a dump that was cut short does not restore.
+#define DUMP_MAGIC 0x504d55444143464cULL // "LFCADUMP"
+#define DUMP_VERSION 1
+struct alignas(64) dump_header {
+    unsigned long long magic;
+    unsigned version;
+    unsigned key_bytes; // Sizes of the key and value types it was written with
+    unsigned value_bytes;
+    unsigned long long leaves; // Number of leaf images
+    unsigned long long index; // Offset of the index
+};
+//=== Query Workers =================================
+// Threads that collect the sub-ranges of parallel range queries. A tree
+// starts them on its first parallel query and joins them when destroyed,
+// so a query only queues its sub-ranges and waits for them. Workers are
+// added until one query's sub-ranges can all run at once; concurrent
+// queries share them.
+struct query_workers {
+    struct task {
+        const std::function<void()>* job;
+        size_t* pending; // Tasks of the same query still running
+    };
+    std::mutex lock;
+    std::condition_variable wake; // A task was queued or the workers stop
+    std::condition_variable done; // A task finished
+    std::deque<task> tasks;
+    std::vector<std::thread> threads;
+    bool stopping = false;
+
+    // Runs own on this thread and every job on a worker, and returns once
+    // all of them are done.
+    void run(const std::vector<std::function<void()> >& jobs, const std::function<void()>& own) {
+        size_t pending = jobs.size();
+        {
+            std::lock_guard<std::mutex> l(lock);
+            while(threads.size() < jobs.size()) threads.push_back(std::thread(&query_workers::work, this));
+            for(size_t i = 0; i < jobs.size(); i++) {
+                task t = { &jobs[i], &pending };
+                tasks.push_back(t);
+            }
+        }
+        wake.notify_all();
+        own();
+        std::unique_lock<std::mutex> l(lock);
+        while(pending > 0) done.wait(l);
+    }
+
+    void work() {
+        std::unique_lock<std::mutex> l(lock);
+        while(true) {
+            while(tasks.empty() && !stopping) wake.wait(l);
+            if(tasks.empty()) return;
+            task t = tasks.front();
+            tasks.pop_front();
+            l.unlock();
+            (*t.job)();
+            l.lock();
+            if(--*t.pending == 0) done.notify_all();
+        }
+    }
+
+    ~query_workers() {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for(size_t i = 0; i < threads.size(); i++) threads[i].join();
+    }
+};
+//=== Helping Policies ==============================
+// Whether an operation that finds a base node held by a join or range
+// query helps that operation finish, which keeps the tree lock-free, or
+// searches again until the owner is done. lfcatree takes one as its
+// seventh template parameter; with no_helping a preempted owner blocks
+// everyone waiting on its base nodes.
+struct helping {
+    static constexpr bool enabled = true;
+};
+
+struct no_helping {
+    static constexpr bool enabled = false;
+};
+enum node_type : unsigned char {
     route, normal, joinmain, joinneighbor, range
 };
 //=== Data Structures ===============================
-template <class T>
-struct rs { // Result storage for range queries (list of values)
-    rs() : more_than_one_base(false) {}
-    std::atomic<std::vector<T>*> result; // The result
-    std::atomic<T> more_than_one_base;
-};
-template <class T>
-struct node {
-    node() : join_id(NULL), valid(true), neigh2((node<T>*)0) {}
-    node_type type;
+template <class T, class Leaf = treap_leaf<T> >
+struct range_leaves : pooled { // Leaves of the base nodes a range query collected, in key order
+    std::vector<typename Leaf::type> leaves; // One reference each
+};
+template <class T, class Leaf>
+struct base_node;
+template <class T, class Leaf = treap_leaf<T> >
+struct txn_info : pooled { // Operations of a multi-key update, sorted by key
+    typedef typename Leaf::value_type value_type;
+    struct moved_value : pooled {
+        bool found;
+        value_type value;
+    };
+    struct op {
+        op() : src(0), claim(NULL), moved(NULL) {}
+        char mode; // 'i' insert, 'p' put, 'r' remove, 'm' put the value ops[src].key had
+        T key;
+        value_type value;
+        size_t src;
+        bool result; // Written by the updating thread after the commit
+        std::atomic<base_node<T, Leaf>*> claim; // Range base holding key, set before the commit
+        std::atomic<moved_value*> moved; // For 'm', set before the commit
+    };
+    txn_info(size_t n) : ops(n), ts(TS_UNSET) {}
+    ~txn_info() {
+        for(size_t i = 0; i < ops.size(); i++) delete (&ops[i].moved)->load();
+    }
+    std::vector<op> ops;
+    std::atomic<unsigned long long> ts; // Stamped after the commit, like a version
+};
+template <class T, class Leaf = treap_leaf<T> >
+struct rs : pooled { // Result storage for range queries and multi-key updates
+    rs() : more_than_one_base(false), refs(1) {}
+    ~rs() { delete txn; }
+    T lo; T hi; // Low and high key
+    bool parallel = false; // Collected by several threads; helpers abort it rather than finish it
+    txn_info<T, Leaf>* txn = NULL; // Set for multi-key updates, whose result is only ever TXN_COMMITTED
+    std::atomic<range_leaves<T, Leaf>*> result; // The result
+    std::atomic<bool> more_than_one_base;
+    std::atomic<int> refs; // Range bases using this storage + the query itself
+};
+// Result of a range query. Shares the immutable leaves the query collected
+// rather than copying their keys, so building it allocates nothing per key
+// and it stays valid for as long as it is held, after the operation that
+// produced it has finished. Keys in [lo, hi] are streamed in ascending
+// order through for_each, or together with their values through
+// for_each_entry, and aggregated in place with count, reduce, min and max.
+template <class T, class Leaf = treap_leaf<T> >
+class range_result {
+    template <class F>
+    struct key_visitor {
+        F& f;
+        void operator()(const T& key, const typename Leaf::value_type&) { f(key); }
+    };
 
-    // normal_base
-    std::vector<T>* data = NULL; // Items in the set
-    int stat = 0; // Statistics variable
-    node<T>* parent = NULL; // Parent node or NULL (root)
+    template <class A, class F>
+    struct fold_visitor {
+        A acc;
+        F& f;
+        void operator()(const T& key, const typename Leaf::value_type& value) { acc = f(acc, key, value); }
+    };
 
-    // range_base
-    int lo; int hi; // Low and high key
-    rs<T>* storage;
+    public:
+    range_result(rs<T, Leaf>* s, const T& lo, const T& hi) : s(s), lo(lo), hi(hi) {} // Takes over a reference to s
+    range_result(const range_result& o) : s(o.s), lo(o.lo), hi(o.hi) {
+        (&s->refs)->fetch_add(1);
+    }
+    range_result& operator=(range_result o) {
+        std::swap(s, o.s); lo = o.lo; hi = o.hi;
+        return *this;
+    }
+    ~range_result() { release(s); }
 
-    // join_main
-    node<T>* neigh1; // First (not joined) neighbor base
-    std::atomic<node<T>*> neigh2; // Joined n...
-    node<T>* gparent; // Grand parent
-    node<T>* otherb; // Other branch
+    // Calls f(key, value) for every key in the range.
+    template <class F>
+    void for_each_entry(F f) const {
+        range_leaves<T, Leaf>* r = (&s->result)->load();
+        for(size_t i = 0; i < r->leaves.size(); i++)
+            Leaf::visit_range(r->leaves[i], lo, hi, f);
+    }
 
-    // join_neighbor
-    node<T>* main_node; // The main node for the join
+    // Calls f(key) for every key in the range.
+    template <class F>
+    void for_each(F f) const {
+        key_visitor<F> v = { f };
+        for_each_entry<key_visitor<F>&>(v);
+    }
 
-	// route_node
-    int key; // Split key
-    std::atomic<node<T>*> left; // < key
-    std::atomic<node<T>*> right; // >= key
-    std::atomic<T> valid; // Used for join
-    std::atomic<node<T>*> join_id; // ...
+    // Number of keys in the range. Base nodes the query collected between
+    // the first and the last lie entirely inside its range, so their leaves
+    // are counted from their size in O(1); the others in O(log n).
+    size_t count() const {
+        range_leaves<T, Leaf>* r = (&s->result)->load();
+        bool whole = !Leaf::less(lo, s->lo) && !Leaf::less(s->lo, lo) &&
+                     !Leaf::less(hi, s->hi) && !Leaf::less(s->hi, hi); // not narrowed
+        size_t n = 0;
+        for(size_t i = 0; i < r->leaves.size(); i++) {
+            if(whole && i > 0 && i + 1 < r->leaves.size()) n += Leaf::size(r->leaves[i]);
+            else n += Leaf::count_range(r->leaves[i], lo, hi);
+        }
+        return n;
+    }
+
+    // Folds the range into acc = f(acc, key, value) in ascending key order.
+    template <class A, class F>
+    A reduce(A acc, F f) const {
+        fold_visitor<A, F> v = { acc, f };
+        for_each_entry<fold_visitor<A, F>&>(v);
+        return v.acc;
+    }
+
+    // The smallest key in the range. False if the range is empty.
+    bool min(T* key) const {
+        range_leaves<T, Leaf>* r = (&s->result)->load();
+        for(size_t i = 0; i < r->leaves.size(); i++) {
+            if(Leaf::next(r->leaves[i], lo, true, key, NULL)) return !Leaf::less(hi, *key);
+        }
+        return false;
+    }
+
+    // The largest key in the range. False if the range is empty.
+    bool max(T* key) const {
+        range_leaves<T, Leaf>* r = (&s->result)->load();
+        if(Leaf::less(hi, lo)) return false;
+        for(size_t i = r->leaves.size(); i > 0; i--) {
+            typename Leaf::type l = r->leaves[i - 1];
+            if(Leaf::lookup(l, hi)) {
+                *key = hi;
+                return true;
+            }
+            if(Leaf::prev(l, hi, key, NULL)) return !Leaf::less(*key, lo);
+        }
+        return false;
+    }
+
+    std::vector<T> to_vector() const {
+        std::vector<T> keys;
+        for_each([&keys](const T& k) { keys.push_back(k); });
+        return keys;
+    }
+
+    static void release_leaves(range_leaves<T, Leaf>* r) {
+        for(size_t i = 0; i < r->leaves.size(); i++) Leaf::release(r->leaves[i]);
+        delete r;
+    }
+
+    // Drops one reference to a range query's result storage.
+    static void release(rs<T, Leaf>* s) {
+        if((&s->refs)->fetch_sub(1) == 1) {
+            range_leaves<T, Leaf>* result = (&s->result)->load();
+            if(result != NOT_SET && result != RANGE_ABORTED && result != TXN_COMMITTED) release_leaves(result);
+            delete s;
+        }
+    }
+
+    private:
+    rs<T, Leaf>* s;
+    T lo; T hi; // May be narrower than the range of s when a query was expanded
+};
+// Route and base nodes have separate layouts that share this header, so a
+// child pointer is checked with `type` and then cast to the right kind.
+template <class T, class Leaf = treap_leaf<T> >
+struct node : pooled {
+    node_type type;
+};
+template <class T, class Leaf = treap_leaf<T> >
+struct route_node;
+template <class T, class Leaf = treap_leaf<T> >
+struct base_node;
+template <class T, class Leaf = treap_leaf<T> >
+struct join_info : pooled { // Shared by the main node and the neighbor of a join
+    join_info() : neigh2((base_node<T, Leaf>*)0), refs(2) {}
+    base_node<T, Leaf>* main_node; // The main node for the join
+    base_node<T, Leaf>* neigh1; // First (not joined) neighbor base
+    std::atomic<base_node<T, Leaf>*> neigh2; // Joined n...
+    route_node<T, Leaf>* gparent; // Grand parent
+    node<T, Leaf>* otherb; // Other branch
+    std::atomic<int> refs; // Main node and neighbor
+};
+template <class T, class Leaf>
+struct route_node : node<T, Leaf> { // 32 bytes for int keys
+    route_node() : valid(true), left(NULL), right(NULL), join_id(NULL) { this->type = route; }
+    std::atomic<bool> valid; // Used for join
+    T key; // Split key
+    std::atomic<node<T, Leaf>*> left; // < key
+    std::atomic<node<T, Leaf>*> right; // >= key
+    std::atomic<base_node<T, Leaf>*> join_id; // ...
 };
-template <class T>
+template <class T, class Leaf>
+struct base_node : node<T, Leaf> { // 48 bytes; join and range state live in side records
+    base_node(node_type t = normal) : ts(0), storage(NULL) { this->type = t; }
+    int stat = 0; // Statistics variable
+    typename Leaf::type data = NULL; // Items in the set (immutable leaf container)
+    route_node<T, Leaf>* parent = NULL; // Parent node or NULL (root)
+    std::atomic<unsigned long long> ts; // Version timestamp, 0 for nodes no snapshot predates
+    base_node<T, Leaf>* prev = NULL; // Version this one replaced, or the left half of a join
+    union {
+        rs<T, Leaf>* storage; // range_base
+        join_info<T, Leaf>* join; // join_main and join_neighbor
+        base_node<T, Leaf>* joined; // normal: right half of the join that made it, if any
+    };
+};
+template <class T, class Leaf = treap_leaf<T> >
 struct lfcat{
-    std::atomic<node<T>*> root;
+    std::atomic<node<T, Leaf>*> root;
+    mapped_file* mapping = NULL; // Dump file a restored tree was mapped from
+    ~lfcat() { if(mapping != NULL) mapped_file::release(mapping); }
+};
+template <class T, class Leaf = treap_leaf<T> >
+struct stack { // Search path of an update or range query, kept on the caller's frame
+    stack() : items(inline_items), size(0), cap(STACK_DEPTH) {}
+    ~stack() { if(items != inline_items) delete[] items; }
+    node<T, Leaf>** items; // Bottom first
+    int size;
+    int cap; // Only grows past STACK_DEPTH for unusually deep trees
+    node<T, Leaf>* inline_items[STACK_DEPTH];
+    private:
+    stack(const stack&); // Use copy_state, items may point into the frame
+    stack& operator=(const stack&);
 };
-template <class T>
-struct stack { // for storing base nodes
-    std::stack<node<T>*>* stack_lib;
-	std::vector<node<T>*>* stack_array;
+// One operation of lfcatree::update. result is set like the return value
+// of the matching single-key function.
+template <class T, class V = no_value>
+struct update_op {
+    char mode; // 'i' insert, 'p' put or 'r' remove
+    T key;
+    V value;
+    bool result;
 };
-//=== Test Structures ===============================
-template <class T>
+//=== Benchmark Structures ==========================
+struct bench_config {
+    std::vector<int> threads; // One configuration per thread count
+    int update_pct = 20; // Half inserts and half removes
+    int range_pct = 0; // Range queries, the remaining operations are lookups
+    int key_range = 100000; // Keys are drawn from [0, key_range)
+    int range_size = 100; // Keys covered by one range query
+    unsigned long long seed = 1; // Runs with the same seed draw the same operations
+    int leaf_size = BULK_LEAF_SIZE; // Entries per base node of the prefilled tree
+    double zipf = 0; // Zipf skew in [0, 1), 0 for uniform keys
+    double warmup = 1; // Seconds before measuring
+    double duration = 5; // Seconds measured
+    std::string leaf = "treap"; // treap or flat
+};
+
+// Draws keys from [0, n), uniformly or from a Zipf distribution where key 0
+// is the most popular (Gray et al., "Quickly generating billion-record
+// synthetic databases"). The zeta constant takes O(n) to compute, so one
+// generator is built per configuration and copied into every thread.
+struct key_generator {
+    int n;
+    double theta, alpha, zetan, eta;
+    xorshift rng;
+
+    key_generator(int n, double theta) : n(n), theta(theta) {
+        if(theta == 0) return;
+        double zeta2 = 1 + std::pow(0.5, theta);
+        zetan = 0;
+        for(int i = 1; i <= n; i++) zetan += 1 / std::pow((double)i, theta);
+        alpha = 1 / (1 - theta);
+        eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan);
+    }
+
+    void seed(unsigned long long s) {
+        rng.seed(s);
+    }
+
+    unsigned long long next_random() {
+        return rng.next();
+    }
+
+    int next() {
+        if(theta == 0) return next_random() % n;
+        double u = (next_random() >> 11) * (1.0 / 9007199254740992.0); // [0, 1)
+        double uz = u * zetan;
+        if(uz < 1) return 0;
+        if(uz < 1 + std::pow(0.5, theta)) return 1;
+        int k = (int)(n * std::pow(eta * u - eta + 1, alpha));
+        return k < n ? k : n - 1;
+    }
+};
+
+template <class T, class Leaf = treap_leaf<T> >
 struct arg_struct {
-    lfcat<T>* tree;
+    lfcat<T, Leaf>* tree;
     int tid;
     void* self;
+    const bench_config* config;
+    const key_generator* keys;
+    std::atomic<bool>* stop;
+    std::atomic<unsigned long> ops; // Completed operations
+    unsigned long keys_read; // Keys returned by range queries
+    char pad[64]; // Keeps the ops counters of two threads on different lines
 };
@@ -0,0 +1,92 @@
+#ifndef LFCAS_ADAPT_H
+#define LFCAS_ADAPT_H
+
+#include <cstddef>
+
+//=== Constants =====================================
+#ifndef MAX_LEAF_SIZE
+#define MAX_LEAF_SIZE 512 // Larger base nodes are split whatever their contention
+#endif
+#ifndef MIN_LEAF_SIZE
+#define MIN_LEAF_SIZE 4 // Smaller base nodes are joined, and splits never go below it
+#endif
+enum contention_info { contended , uncontened , noinfo };
+
+//=== Adaptation Policies ===========================
+// An adaptation policy decides how the statistics of base nodes move and
+// when a base node is split or joined. lfcatree keeps one as its public
+// `adaptation` member, checks its `enabled` constant before reading
+// anything about a base node, and asks it for
+//   next_stat(stat, info, multi_base)  the statistic of a node replacing one
+//                                      with `stat`
+//   split(stat, n), join(stat, n)      whether a base node with statistic
+//                                      `stat` and n entries should adapt
+// and reads its max_leaf_size and min_leaf_size when sizing new base nodes.
+
+// The heuristic of the LFCA tree paper: contention pushes the statistic up,
+// uncontended updates pull it down, and range queries spanning several base
+// nodes pull it down further. Thresholds come from Limits.
+template <class Limits>
+struct contention_adaptation : Limits {
+    static const bool enabled = true;
+
+    // multi_base is set for range bases of queries that span more than one
+    // base node.
+    int next_stat(int stat, contention_info info, bool multi_base) const {
+        int range_sub = multi_base ? this->range_contrib : 0;
+        if(info == contended && stat <= this->high_cont)
+            return stat + this->cont_contrib - range_sub;
+        if(info == uncontened && stat >= this->low_cont)
+            return stat - this->low_cont_contrib - range_sub;
+        return stat;
+    }
+
+    bool split(int stat, size_t n) const {
+        return stat > this->high_cont || n > this->max_leaf_size;
+    }
+
+    // Larger leaves would most likely join past the maximum.
+    bool join(int stat, size_t n) const {
+        return (stat < this->low_cont && n <= this->max_leaf_size / 2) || n < this->min_leaf_size;
+    }
+};
+
+// Thresholds fixed at compile time, which fold into the tree's code.
+template <int ContContrib = 250, int LowContContrib = 1, int RangeContrib = 100,
+          int HighCont = 1000, int LowCont = -1000,
+          size_t MaxLeafSize = MAX_LEAF_SIZE, size_t MinLeafSize = MIN_LEAF_SIZE>
+struct fixed_limits {
+    static constexpr int cont_contrib = ContContrib; // Added per contended update
+    static constexpr int low_cont_contrib = LowContContrib; // Subtracted per uncontended update
+    static constexpr int range_contrib = RangeContrib; // Subtracted for multi-base range queries
+    static constexpr int high_cont = HighCont; // Split above
+    static constexpr int low_cont = LowCont; // Join below
+    static constexpr size_t max_leaf_size = MaxLeafSize;
+    static constexpr size_t min_leaf_size = MinLeafSize;
+};
+
+// Thresholds that can be changed at run time. Set them before the tree is
+// shared between threads.
+struct tunable_limits {
+    int cont_contrib = fixed_limits<>::cont_contrib;
+    int low_cont_contrib = fixed_limits<>::low_cont_contrib;
+    int range_contrib = fixed_limits<>::range_contrib;
+    int high_cont = fixed_limits<>::high_cont;
+    int low_cont = fixed_limits<>::low_cont;
+    size_t max_leaf_size = fixed_limits<>::max_leaf_size;
+    size_t min_leaf_size = fixed_limits<>::min_leaf_size;
+};
+
+// Never splits or joins, so base nodes keep the size bulk loading or the
+// initial insertions gave them. For measuring what adaptation costs.
+struct no_adaptation : fixed_limits<> {
+    static const bool enabled = false;
+    int next_stat(int stat, contention_info, bool) const { return stat; }
+    bool split(int, size_t) const { return false; }
+    bool join(int, size_t) const { return false; }
+};
+
+typedef contention_adaptation<fixed_limits<> > default_adaptation;
+typedef contention_adaptation<tunable_limits> tunable_adaptation;
+
+#endif
@@ -0,0 +1,480 @@
+#ifndef LFCAS_FLAT_H
+#define LFCAS_FLAT_H
+
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <functional>
+#include <utility>
+#include <iterator>
+#include <ostream>
+#include "lfcas_treap.h"
+#include "lfcas_pool.h"
+#include <sys/mman.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+//=== Data Structures ===============================
+// Immutable sorted array of keys. The header takes one cache line and the
+// keys start on the next one; the key area is padded to whole cache lines
+// with copies of the largest key so vector loads never leave the array.
+// Values, unless empty, follow the key area in a parallel array so the
+// search only touches keys.
+template <class K, class V = no_value>
+struct alignas(64) flat_array {
+    size_t size; // Number of keys
+    size_t cap; // Number of slots, a multiple of a cache line
+    std::atomic<int> refs;
+    bool mapped = false; // Part of a mapped dump file, counted in its mapped_file
+
+    K* keys() { return reinterpret_cast<K*>(this + 1); }
+    const K* keys() const { return reinterpret_cast<const K*>(this + 1); }
+    V* values() { return reinterpret_cast<V*>(keys() + cap); }
+};
+
+// A dump file mapped by restore. Its leaves are counted here as a whole
+// rather than in their own headers, so the file is never written, and it
+// is unmapped once the tree restored from it and the last of its leaves are
+// gone. Records are looked up without a lock and so never freed.
+struct mapped_file {
+    std::atomic<const char*> begin; // NULL once unmapped
+    std::atomic<const char*> end;
+    std::atomic<long> refs;
+    mapped_file* next;
+
+    static std::atomic<mapped_file*>& files() {
+        static std::atomic<mapped_file*> head(NULL);
+        return head;
+    }
+
+    // Takes over the n bytes mapped at p, with refs references to them.
+    static mapped_file* add(void* p, size_t n, long refs) {
+        mapped_file* f = new mapped_file();
+        (&f->begin)->store(static_cast<const char*>(p));
+        (&f->end)->store(static_cast<const char*>(p) + n);
+        (&f->refs)->store(refs);
+        f->next = (&files())->load();
+        while(!(&files())->compare_exchange_weak(f->next, f)) {}
+        return f;
+    }
+
+    // The file holding p, which must be in one.
+    static mapped_file* of(const void* p) {
+        const char* c = static_cast<const char*>(p);
+        mapped_file* f = (&files())->load();
+        while(!(c >= (&f->begin)->load() && c < (&f->end)->load())) f = f->next;
+        return f;
+    }
+
+    static void retain(mapped_file* f) {
+        (&f->refs)->fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The range is cleared before the unmap, so memory later allocated
+    // there is not taken for part of the file.
+    static void release(mapped_file* f) {
+        if((&f->refs)->fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+        const char* p = (&f->begin)->load();
+        size_t n = (&f->end)->load() - p;
+        (&f->begin)->store(NULL);
+        (&f->end)->store(NULL);
+        munmap(const_cast<char*>(p), n);
+    }
+};
+
+//=== Search ========================================
+// Narrows [keys, keys + n) down to at most `window` keys, returning the
+// start of a range [base, base + n] that holds the first key >= key.
+// Branchless: the loop only depends on n, and the comparison compiles to a
+// conditional move.
+template <class K, class Compare>
+const K* flat_narrow(const K* keys, size_t* n, const K& key, size_t window) {
+    const K* base = keys;
+    while(*n > window) {
+        size_t half = *n / 2;
+        base = Compare()(base[half], key) ? base + half : base;
+        *n -= half;
+    }
+    return base;
+}
+
+// Index of the first key >= key.
+template <class K, class Compare>
+size_t flat_lower_bound(const K* keys, size_t n, const K& key) {
+    const K* base = flat_narrow<K, Compare>(keys, &n, key, 1);
+    return (base - keys) + (n == 1 && Compare()(*base, key));
+}
+
+// Index of key, or n if it is missing.
+template <class K, class Compare>
+struct flat_search {
+    static size_t find(const K* keys, size_t n, size_t, const K& key) {
+        size_t i = flat_lower_bound<K, Compare>(keys, n, key);
+        return i < n && !Compare()(key, keys[i]) ? i : n;
+    }
+};
+
+#ifdef __AVX2__
+// For int keys the binary search stops once the candidates fit in 16 keys
+// (one cache line), which are then compared in two AVX2 instructions.
+template <>
+struct flat_search<int, std::less<int> > {
+    static size_t find(const int* keys, size_t n, size_t cap, const int& key) {
+        size_t window = n;
+        size_t start = flat_narrow<int, std::less<int> >(keys, &window, key, 15) - keys;
+        if(start + 16 > cap) start = cap - 16; // stay inside the padded slots
+        __m256i k = _mm256_set1_epi32(key);
+        __m256i a = _mm256_loadu_si256((const __m256i*)(keys + start));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(keys + start + 8));
+        unsigned lo = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(a, k)));
+        unsigned hi = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(b, k)));
+        unsigned eq = lo | (hi << 8);
+        if(eq == 0) return n;
+        size_t i = start + __builtin_ctz(eq);
+        return i < n ? i : n; // the padding only repeats the last key
+    }
+};
+#endif
+
+//=== Flat Leaf Container ===========================
+// Leaf container keeping the keys of a base node sorted in one contiguous,
+// cache aligned array (NULL when empty). Lookups are a branchless binary
+// search, vectorized for int keys when compiled with AVX2. Every update
+// copies the array, so this suits lookup heavy workloads with small to
+// medium sized leaves; treap_leaf suits update heavy ones.
+//
+// Same interface and ownership rules as treap_leaf, plus an image format
+// for dump files.
+template <class K, class V = no_value, class Compare = std::less<K> >
+struct flat_leaf {
+    static_assert(std::is_trivially_copyable<K>::value, "flat_leaf keys are copied with memcpy");
+    static_assert(std::is_trivially_copyable<V>::value, "flat_leaf values are copied with memcpy");
+
+    typedef flat_array<K, V>* type;
+    typedef K key_type;
+    typedef V value_type;
+
+    static const size_t line = 64 / sizeof(K) > 0 ? 64 / sizeof(K) : 1; // Keys per cache line
+    static const bool has_values = !std::is_empty<V>::value;
+    static const size_t min_cap = (16 + line - 1) / line * line; // Room for a full search window
+
+    static bool less(const K& a, const K& b) {
+        return Compare()(a, b);
+    }
+
+    static const K& key_of(const K& k) { return k; }
+    static const K& key_of(const std::pair<K, V>& e) { return e.first; }
+    static V value_of(const K&) { return V(); }
+    static const V& value_of(const std::pair<K, V>& e) { return e.second; }
+
+    static size_t bytes(size_t cap) {
+        return sizeof(flat_array<K, V>) + cap * sizeof(K) + (has_values ? cap * sizeof(V) : 0);
+    }
+
+    static flat_array<K, V>* allocate(size_t n) {
+        size_t cap = (n + line - 1) / line * line;
+        if(cap < min_cap) cap = min_cap;
+        void* p = node_pool::allocate_aligned(bytes(cap));
+        flat_array<K, V>* a = new (p) flat_array<K, V>();
+        a->size = n;
+        a->cap = cap;
+        (&a->refs)->store(1, std::memory_order_relaxed);
+        return a;
+    }
+
+    // Fill the padding slots with the largest key.
+    static flat_array<K, V>* seal(flat_array<K, V>* a) {
+        if(a->size == 0) {
+            release(a);
+            return NULL;
+        }
+        K* k = a->keys();
+        for(size_t i = a->size; i < a->cap; i++) k[i] = k[a->size - 1];
+        return a;
+    }
+
+    // Copies n entries from position i of a to position j of b.
+    static void move_entries(flat_array<K, V>* b, size_t j, flat_array<K, V>* a, size_t i, size_t n) {
+        if(n == 0) return;
+        memcpy(b->keys() + j, a->keys() + i, n * sizeof(K));
+        if(has_values) memcpy(b->values() + j, a->values() + i, n * sizeof(V));
+    }
+
+    static void set_entry(flat_array<K, V>* a, size_t i, const K& key, const V& value) {
+        a->keys()[i] = key;
+        if(has_values) a->values()[i] = value;
+    }
+
+    static flat_array<K, V>* retain(flat_array<K, V>* a) {
+        if(a == NULL) return a;
+        if(a->mapped) mapped_file::retain(mapped_file::of(a));
+        else (&a->refs)->fetch_add(1, std::memory_order_relaxed);
+        return a;
+    }
+
+    static void release(flat_array<K, V>* a) {
+        if(a == NULL) return;
+        if(a->mapped) {
+            mapped_file::release(mapped_file::of(a));
+            return;
+        }
+        if((&a->refs)->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            size_t cap = a->cap;
+            a->~flat_array<K, V>();
+            node_pool::deallocate_aligned(a, bytes(cap));
+        }
+    }
+
+    static size_t size(flat_array<K, V>* a) {
+        return a == NULL ? 0 : a->size;
+    }
+
+    static size_t index_of(flat_array<K, V>* a, const K& key) {
+        return flat_search<K, Compare>::find(a->keys(), a->size, a->cap, key);
+    }
+
+    // The value stored with key, or NULL if key is not in a.
+    static const V* find(flat_array<K, V>* a, const K& key) {
+        static const V none = V();
+        if(a == NULL) return NULL;
+        size_t i = index_of(a, key);
+        if(i == a->size) return NULL;
+        return has_values ? &a->values()[i] : &none;
+    }
+
+    static bool lookup(flat_array<K, V>* a, const K& key) {
+        return a != NULL && index_of(a, key) != a->size;
+    }
+
+    static const K& min(flat_array<K, V>* a) {
+        return a->keys()[0];
+    }
+
+    static const K& max(flat_array<K, V>* a) {
+        return a->keys()[a->size - 1];
+    }
+
+    static const K& select(flat_array<K, V>* a, size_t rank) {
+        return a->keys()[rank];
+    }
+
+    static flat_array<K, V>* copy_range(flat_array<K, V>* a, size_t i, size_t n) {
+        flat_array<K, V>* b = allocate(n);
+        move_entries(b, 0, a, i, n);
+        return seal(b);
+    }
+
+    static size_t lower_bound(flat_array<K, V>* a, const K& key) {
+        return a == NULL ? 0 : flat_lower_bound<K, Compare>(a->keys(), a->size, key);
+    }
+
+    // Number of keys in [lo, hi].
+    static size_t count_range(flat_array<K, V>* a, const K& lo, const K& hi) {
+        if(less(hi, lo)) return 0;
+        size_t i = lower_bound(a, lo);
+        size_t j = lower_bound(a, hi);
+        if(j < size(a) && !less(hi, a->keys()[j])) j++;
+        return j - i;
+    }
+
+    // Navigation
+    // Copies entry i to *key and, unless value is NULL, *value.
+    static bool entry(flat_array<K, V>* a, size_t i, K* key, V* value) {
+        *key = a->keys()[i];
+        if(value != NULL && has_values) *value = a->values()[i];
+        return true;
+    }
+
+    // The first entry after key, or at key if inclusive.
+    static bool next(flat_array<K, V>* a, const K& key, bool inclusive, K* found, V* value) {
+        size_t i = lower_bound(a, key);
+        if(!inclusive && i < size(a) && !less(key, a->keys()[i])) i++;
+        return i < size(a) && entry(a, i, found, value);
+    }
+
+    // The last entry before key.
+    static bool prev(flat_array<K, V>* a, const K& key, K* found, V* value) {
+        size_t i = lower_bound(a, key);
+        return i > 0 && entry(a, i - 1, found, value);
+    }
+
+    static bool first(flat_array<K, V>* a, K* found, V* value) {
+        return size(a) > 0 && entry(a, 0, found, value);
+    }
+
+    static bool last(flat_array<K, V>* a, K* found, V* value) {
+        return size(a) > 0 && entry(a, a->size - 1, found, value);
+    }
+
+    // Splits a into the keys < key (*lo) and the keys >= key (*hi).
+    static void split(flat_array<K, V>* a, const K& key, flat_array<K, V>** lo, flat_array<K, V>** hi) {
+        size_t n = size(a);
+        size_t i = lower_bound(a, key);
+        *lo = i == 0 ? NULL : copy_range(a, 0, i);
+        *hi = i == n ? NULL : copy_range(a, i, n - i);
+    }
+
+    // Splits a into k non-empty parts of nearly equal size, in key order,
+    // copying each entry once.
+    static void split_n(flat_array<K, V>* a, size_t k, flat_array<K, V>** parts) {
+        size_t n = size(a);
+        for(size_t i = 0; i < k; i++)
+            parts[i] = copy_range(a, n * i / k, n * (i + 1) / k - n * i / k);
+    }
+
+    // Joins two arrays where every key in a is smaller than every key in b.
+    static flat_array<K, V>* join(flat_array<K, V>* a, flat_array<K, V>* b) {
+        if(a == NULL) return retain(b);
+        if(b == NULL) return retain(a);
+        flat_array<K, V>* ab = allocate(a->size + b->size);
+        move_entries(ab, 0, a, 0, a->size);
+        move_entries(ab, a->size, b, 0, b->size);
+        return seal(ab);
+    }
+
+    // Insertion and Removal
+    // *res is true if key was not in a. An existing key keeps its value
+    // unless `assign` is set.
+    static flat_array<K, V>* insert(flat_array<K, V>* a, const K& key, const V& value, bool assign, bool* res) {
+        size_t n = size(a);
+        size_t i = lower_bound(a, key);
+        *res = i == n || less(key, a->keys()[i]);
+        if(!*res) {
+            if(!assign || !has_values) return retain(a);
+            flat_array<K, V>* b = copy_range(a, 0, n);
+            b->values()[i] = value;
+            return b;
+        }
+        flat_array<K, V>* b = allocate(n + 1);
+        move_entries(b, 0, a, 0, i);
+        set_entry(b, i, key, value);
+        move_entries(b, i + 1, a, i, n - i);
+        return seal(b);
+    }
+
+    static flat_array<K, V>* remove(flat_array<K, V>* a, const K& key, bool* res) {
+        size_t n = size(a);
+        size_t i = lower_bound(a, key);
+        *res = i < n && !less(key, a->keys()[i]);
+        if(!*res) return retain(a);
+        flat_array<K, V>* b = allocate(n - 1);
+        move_entries(b, 0, a, 0, i);
+        move_entries(b, i, a, i + 1, n - i - 1);
+        return seal(b);
+    }
+
+    // Merges the sorted, duplicate free entries [first, last) into a copy of
+    // a in one pass, keeping the value of keys already in a. *added counts
+    // the new keys.
+    template <class It>
+    static flat_array<K, V>* insert_batch(flat_array<K, V>* a, It first, It last, size_t* added) {
+        size_t n = size(a);
+        flat_array<K, V>* b = allocate(n + std::distance(first, last));
+        size_t i = 0, j = 0;
+        for(; first != last; ++first) {
+            const K& key = key_of(*first);
+            if(i < n) { // copy the run of keys below key
+                size_t e = i + flat_lower_bound<K, Compare>(a->keys() + i, n - i, key);
+                move_entries(b, j, a, i, e - i);
+                j += e - i;
+                i = e;
+                if(i < n && !less(key, a->keys()[i])) continue; // already present
+            }
+            set_entry(b, j++, key, value_of(*first));
+        }
+        move_entries(b, j, a, i, n - i);
+        b->size = j + (n - i);
+        *added = b->size - n;
+        return seal(b);
+    }
+
+    // Removes the sorted, duplicate free keys [first, last) in one pass.
+    // *removed counts the keys that were in a.
+    template <class It>
+    static flat_array<K, V>* remove_batch(flat_array<K, V>* a, It first, It last, size_t* removed) {
+        *removed = 0;
+        size_t n = size(a);
+        if(n == 0) return NULL;
+        flat_array<K, V>* b = allocate(n);
+        size_t i = 0, j = 0;
+        for(; first != last && i < n; ++first) {
+            size_t e = i + flat_lower_bound<K, Compare>(a->keys() + i, n - i, key_of(*first));
+            move_entries(b, j, a, i, e - i);
+            j += e - i;
+            i = e;
+            if(i < n && !less(key_of(*first), a->keys()[i])) { // drop it
+                i++;
+                (*removed)++;
+            }
+        }
+        move_entries(b, j, a, i, n - i);
+        b->size = j + (n - i);
+        return seal(b);
+    }
+
+    // Builds an array from sorted, duplicate free entries.
+    template <class It>
+    static flat_array<K, V>* from_sorted(It first, It last) {
+        size_t n = std::distance(first, last);
+        if(n == 0) return NULL;
+        flat_array<K, V>* a = allocate(n);
+        for(size_t i = 0; first != last; ++first, i++)
+            set_entry(a, i, key_of(*first), value_of(*first));
+        return seal(a);
+    }
+
+    // Dump Files
+    // A leaf is dumped as an image of its array marked as mapped, which a
+    // restored tree then uses in place. Writes the image of a, padded to a
+    // cache line, and returns its size. Only the header fields and the
+    // entries are copied; everything else is zeros, so equal leaves give
+    // equal images.
+    static size_t write_image(std::ostream& out, flat_array<K, V>* a) {
+        alignas(flat_array<K, V>) char head[sizeof(flat_array<K, V>)] = {};
+        flat_array<K, V>* h = new (head) flat_array<K, V>();
+        h->size = a->size;
+        h->cap = a->cap;
+        (&h->refs)->store(1, std::memory_order_relaxed);
+        h->mapped = true;
+        out.write(head, sizeof(head));
+        h->~flat_array<K, V>();
+        out.write(reinterpret_cast<const char*>(a->keys()), a->cap * sizeof(K)); // sealed, the spare slots repeat the largest key
+        if(has_values) {
+            out.write(reinterpret_cast<const char*>(a->values()), a->size * sizeof(V));
+            write_zeros(out, (a->cap - a->size) * sizeof(V));
+        }
+        size_t n = bytes(a->cap), padded = (n + 63) / 64 * 64;
+        write_zeros(out, padded - n);
+        return padded;
+    }
+
+    static void write_zeros(std::ostream& out, size_t n) {
+        for(size_t i = 0; i < n; i++) out.put(0);
+    }
+
+    // The leaf whose image starts at p, within n bytes, or NULL if there is
+    // no valid image there.
+    static flat_array<K, V>* map_image(const char* p, size_t n) {
+        const flat_array<K, V>* a = reinterpret_cast<const flat_array<K, V>*>(p);
+        if(n < sizeof(flat_array<K, V>) || !a->mapped || a->size == 0 || a->size > a->cap ||
+           a->cap < min_cap || a->cap % line != 0 || a->cap > n || bytes(a->cap) > n) return NULL;
+        return const_cast<flat_array<K, V>*>(a);
+    }
+
+    // Calls f(key, value) for the keys in [lo, hi] in ascending order.
+    template <class F>
+    static void visit_range(flat_array<K, V>* a, const K& lo, const K& hi, F& f) {
+        static const V none = V();
+        if(a == NULL) return;
+        const K* k = a->keys();
+        for(size_t i = lower_bound(a, lo); i < a->size && !less(hi, k[i]); i++)
+            f(k[i], has_values ? a->values()[i] : none);
+    }
+};
+
+#endif
@@ -0,0 +1,276 @@
+#ifndef LFCAS_POOL_H
+#define LFCAS_POOL_H
+
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <cstddef>
+#include <new>
+#ifdef LFCAS_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+//=== Constants =====================================
+#ifndef POOL_CHUNK_SIZE
+#define POOL_CHUNK_SIZE (2 << 20) // Bytes a thread carves blocks from at a time, one huge page
+#endif
+#ifndef POOL_MAX_BLOCK
+#define POOL_MAX_BLOCK 4096 // Larger allocations go to malloc
+#endif
+#ifndef POOL_BATCH
+#define POOL_BATCH 64 // Free blocks a thread hands to or takes from the depot at once
+#endif
+
+//=== Node Pool =====================================
+// Allocator for route and base nodes, join records, range storage and leaf
+// containers. Build with -DLFCAS_POOL to enable it; otherwise it forwards
+// to operator new and posix_memalign.
+//
+// Every thread keeps a free list per size class and carves new blocks out
+// of its own chunk, so allocation takes no lock. Blocks are freed onto the
+// list of whichever thread frees them, which with epoch reclamation is
+// usually the thread that unlinked them. A thread whose list grows past
+// 2 * POOL_BATCH moves POOL_BATCH blocks to a shared depot, where threads
+// that run dry look before carving. The uncarved tail of a chunk goes to
+// the depot too, when it is too short for the next block or its thread
+// exits, and threads carve from such tails before taking a new chunk, so
+// short-lived threads strand no memory. Chunks are never returned to the
+// system. With -DLFCAS_HUGE_PAGES chunks are aligned to, and advised as,
+// transparent huge pages.
+struct node_pool {
+    // Sizes up to 64 bytes are rounded to 16, larger ones to 64 so blocks
+    // of 64 bytes and more are cache line aligned.
+    static const size_t classes = 4 + POOL_MAX_BLOCK / 64 - 1;
+
+    static size_t class_of(size_t n) {
+        if(n <= 64) return n == 0 ? 0 : (n - 1) / 16;
+        return 4 + (n - 65) / 64;
+    }
+
+    static size_t class_size(size_t c) {
+        return c < 4 ? (c + 1) * 16 : (c - 2) * 64;
+    }
+
+    struct batch {
+        void* head; // Blocks linked through their first word
+        size_t count;
+    };
+
+    struct tail {
+        char* bump; // Uncarved part of a chunk
+        char* end;
+    };
+
+    struct depot {
+        std::mutex lock;
+        std::vector<batch> batches[classes];
+        std::vector<tail> tails;
+    };
+
+    struct thread_cache {
+        void* heads[classes];
+        size_t counts[classes];
+        char* bump; // Uncarved part of the current chunk
+        char* end;
+        thread_cache() : bump(NULL), end(NULL) {
+            for(size_t c = 0; c < classes; c++) {
+                heads[c] = NULL;
+                counts[c] = 0;
+            }
+        }
+    };
+
+    // Hands a thread's blocks to the depot when it exits.
+    struct cache_owner {
+        ~cache_owner() {
+            thread_cache*& c = current();
+            if(c == NULL) return;
+            for(size_t i = 0; i < classes; i++) {
+                if(c->counts[i] > 0) give(i, c->heads[i], c->counts[i]);
+            }
+            give_tail(c);
+            delete c;
+            c = NULL; // later frees on this thread go straight to the depot
+        }
+    };
+
+    static depot& global() {
+        static depot* d = new depot(); // never destroyed, threads may outlive main
+        return *d;
+    }
+
+    static thread_cache*& current() {
+        static thread_local thread_cache* c = NULL;
+        return c;
+    }
+
+    static thread_cache* local() {
+        thread_cache*& c = current();
+        if(c == NULL) {
+            static thread_local cache_owner owner;
+            (void)owner;
+            c = new thread_cache();
+        }
+        return c;
+    }
+
+    static void give(size_t c, void* head, size_t count) {
+        depot& d = global();
+        std::lock_guard<std::mutex> hold(d.lock);
+        batch b = { head, count };
+        d.batches[c].push_back(b);
+    }
+
+    static bool take(thread_cache* t, size_t c) {
+        depot& d = global();
+        std::lock_guard<std::mutex> hold(d.lock);
+        if(d.batches[c].empty()) return false;
+        batch b = d.batches[c].back();
+        d.batches[c].pop_back();
+        t->heads[c] = b.head;
+        t->counts[c] = b.count;
+        return true;
+    }
+
+    // Hands the rest of t's chunk to the depot, unless it is too short to
+    // hold any block.
+    static void give_tail(thread_cache* t) {
+        if(t->bump == NULL || t->end - t->bump < 16) return;
+        depot& d = global();
+        std::lock_guard<std::mutex> hold(d.lock);
+        tail x = { t->bump, t->end };
+        d.tails.push_back(x);
+        t->bump = t->end = NULL;
+    }
+
+    // Makes a tail from the depot with room for size bytes at the given
+    // alignment the rest of t's chunk.
+    static bool take_tail(thread_cache* t, size_t size, size_t align) {
+        depot& d = global();
+        std::lock_guard<std::mutex> hold(d.lock);
+        for(size_t i = d.tails.size(); i-- > 0; ) {
+            tail x = d.tails[i];
+            char* p = (char*)(((size_t)x.bump + align - 1) & ~(align - 1));
+            if(p + size > x.end) continue;
+            d.tails[i] = d.tails.back();
+            d.tails.pop_back();
+            t->bump = x.bump;
+            t->end = x.end;
+            return true;
+        }
+        return false;
+    }
+
+    static void* chunk() {
+        void* p;
+#ifdef LFCAS_HUGE_PAGES
+        if(posix_memalign(&p, POOL_CHUNK_SIZE, POOL_CHUNK_SIZE) != 0) throw std::bad_alloc();
+        madvise(p, POOL_CHUNK_SIZE, MADV_HUGEPAGE);
+#else
+        if(posix_memalign(&p, 64, POOL_CHUNK_SIZE) != 0) throw std::bad_alloc();
+#endif
+        return p;
+    }
+
+    static void* carve(thread_cache* t, size_t size) {
+        size_t align = size >= 64 ? 64 : 16;
+        char* p = (char*)(((size_t)t->bump + align - 1) & ~(align - 1));
+        if(t->bump == NULL || p + size > t->end) {
+            give_tail(t);
+            if(!take_tail(t, size, align)) {
+                t->bump = (char*)chunk();
+                t->end = t->bump + POOL_CHUNK_SIZE;
+            }
+            p = (char*)(((size_t)t->bump + align - 1) & ~(align - 1));
+        }
+        t->bump = p + size;
+        return p;
+    }
+
+    static void* pool_allocate(size_t n) {
+        if(n > POOL_MAX_BLOCK) return aligned_malloc(n);
+        size_t c = class_of(n);
+        thread_cache* t = local();
+        if(t->heads[c] == NULL && !take(t, c)) return carve(t, class_size(c));
+        void* p = t->heads[c];
+        t->heads[c] = *(void**)p;
+        t->counts[c]--;
+        return p;
+    }
+
+    static void pool_deallocate(void* p, size_t n) {
+        if(n > POOL_MAX_BLOCK) {
+            free(p);
+            return;
+        }
+        size_t c = class_of(n);
+        thread_cache* t = current();
+        if(t == NULL) { // the thread's cache is gone, at exit
+            *(void**)p = NULL;
+            give(c, p, 1);
+            return;
+        }
+        *(void**)p = t->heads[c];
+        t->heads[c] = p;
+        if(++t->counts[c] >= 2 * POOL_BATCH) {
+            void* head = t->heads[c];
+            void* last = head;
+            for(int i = 1; i < POOL_BATCH; i++) last = *(void**)last;
+            t->heads[c] = *(void**)last;
+            *(void**)last = NULL;
+            t->counts[c] -= POOL_BATCH;
+            give(c, head, POOL_BATCH);
+        }
+    }
+
+    static void* aligned_malloc(size_t n) {
+        void* p;
+        if(posix_memalign(&p, 64, n) != 0) throw std::bad_alloc();
+        return p;
+    }
+
+    // n bytes, at least 16-byte aligned.
+    static void* allocate(size_t n) {
+#ifdef LFCAS_POOL
+        return pool_allocate(n);
+#else
+        return ::operator new(n);
+#endif
+    }
+
+    static void deallocate(void* p, size_t n) {
+#ifdef LFCAS_POOL
+        pool_deallocate(p, n);
+#else
+        (void)n;
+        ::operator delete(p);
+#endif
+    }
+
+    // n bytes aligned to a cache line.
+    static void* allocate_aligned(size_t n) {
+#ifdef LFCAS_POOL
+        return pool_allocate(n < 64 ? 64 : n);
+#else
+        return aligned_malloc(n);
+#endif
+    }
+
+    static void deallocate_aligned(void* p, size_t n) {
+#ifdef LFCAS_POOL
+        pool_deallocate(p, n < 64 ? 64 : n);
+#else
+        (void)n;
+        free(p);
+#endif
+    }
+};
+
+// Base for the types allocated through node_pool. Objects must be deleted
+// through a pointer to their own type, so the size passed back is right.
+struct pooled {
+    static void* operator new(size_t n) { return node_pool::allocate(n); }
+    static void operator delete(void* p, size_t n) { node_pool::deallocate(p, n); }
+};
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef LFCAS_RECLAIM_H
+#define LFCAS_RECLAIM_H
+
+#include <atomic>
+#include <vector>
+#include <cstdlib>
+#include <mutex>
+#include <utility>
+
+//=== Constants =====================================
+#ifndef RECLAIM_MAX_THREADS
+#define RECLAIM_MAX_THREADS 256 // Threads that may be inside the tree at once
+#endif
+#ifndef RECLAIM_BATCH
+#define RECLAIM_BATCH 128 // Retired objects before trying to advance the epoch
+#endif
+
+//=== Reclaimers ====================================
+// A reclaimer decides when memory unlinked from the tree may be freed. Every
+// public operation of lfcatree holds a `Reclaimer::guard` for its duration,
+// and every pointer swung away by a successful CAS is handed to
+// `Reclaimer::retire` together with the function that frees it.
+
+// Never frees anything. Useful as a baseline when benchmarking.
+struct leak_reclaimer {
+    struct guard {
+        guard() {}
+    };
+    static void retire(void*, void (*)(void*)) {}
+};
+
+// Epoch based reclamation (Fraser). Threads announce the global epoch they
+// observed when entering an operation and the epoch only advances once every
+// active thread has observed it. An object retired in epoch e can be freed
+// once the global epoch reaches e + 2, since by then every active thread
+// entered after the object was unlinked.
+struct epoch_reclaimer {
+    struct retired {
+        void* p;
+        void (*free_fn)(void*);
+    };
+
+    struct bag { // Objects retired during a single epoch
+        unsigned long epoch = 0;
+        std::vector<retired> items;
+    };
+
+    struct alignas(64) record { // Per-thread state, padded to a cache line
+        std::atomic<bool> in_use;
+        std::atomic<unsigned long> state; // (epoch << 1) | active
+        int nest = 0; // Guard nesting depth
+        unsigned long retired_count = 0;
+        bag bags[3];
+        record() : in_use(false), state(0) {}
+    };
+
+    struct domain {
+        std::atomic<unsigned long> epoch;
+        record records[RECLAIM_MAX_THREADS];
+        std::mutex orphan_lock;
+        std::vector<bag> orphans; // Bags of exited threads, freed by try_advance
+        domain() : epoch(2) {}
+    };
+
+    static domain& global() {
+        static domain d;
+        return d;
+    }
+
+    // Claims a free record on first use and gives it back on thread exit.
+    // Bags still holding retired objects move to the domain's orphans, so
+    // they are freed as the epoch advances rather than when (or if) another
+    // thread claims the record.
+    struct owner {
+        record* rec = NULL;
+        ~owner() {
+            if(rec == NULL) return;
+            domain& d = global();
+            {
+                std::lock_guard<std::mutex> l(d.orphan_lock);
+                for(int i = 0; i < 3; i++) {
+                    if(rec->bags[i].items.empty()) continue;
+                    d.orphans.push_back(bag());
+                    d.orphans.back().epoch = rec->bags[i].epoch;
+                    d.orphans.back().items.swap(rec->bags[i].items);
+                }
+            }
+            (&rec->in_use)->store(false, std::memory_order_release);
+        }
+    };
+
+    static record* my_record() {
+        static thread_local owner o;
+        if(o.rec == NULL) {
+            domain& d = global();
+            for(int i = 0; i < RECLAIM_MAX_THREADS; i++) {
+                bool expected = false;
+                if(!(&d.records[i].in_use)->load(std::memory_order_relaxed) &&
+                   d.records[i].in_use.compare_exchange_strong(expected, true,
+                   std::memory_order_acquire, std::memory_order_relaxed)) {
+                    o.rec = &d.records[i];
+                    break;
+                }
+            }
+            if(o.rec == NULL) std::abort(); // more than RECLAIM_MAX_THREADS threads
+        }
+        return o.rec;
+    }
+
+    static void free_bag(bag& b) {
+        for(size_t i = 0; i < b.items.size(); i++)
+            b.items[i].free_fn(b.items[i].p);
+        b.items.clear();
+    }
+
+    // Free every bag that is at least two epochs older than `e`.
+    static void collect(record* r, unsigned long e) {
+        for(int i = 0; i < 3; i++) {
+            if(!r->bags[i].items.empty() && r->bags[i].epoch + 2 <= e)
+                free_bag(r->bags[i]);
+        }
+    }
+
+    // Free the orphaned bags that are at least two epochs older than `e`.
+    static void collect_orphans(unsigned long e) {
+        domain& d = global();
+        std::vector<bag> ready;
+        {
+            std::lock_guard<std::mutex> l(d.orphan_lock);
+            for(size_t i = 0; i < d.orphans.size(); ) {
+                if(d.orphans[i].epoch + 2 <= e) {
+                    std::swap(d.orphans[i], d.orphans.back());
+                    ready.push_back(bag());
+                    ready.back().items.swap(d.orphans.back().items);
+                    d.orphans.pop_back();
+                } else {
+                    i++;
+                }
+            }
+        }
+        for(size_t i = 0; i < ready.size(); i++) free_bag(ready[i]);
+    }
+
+    // Advance the global epoch if every active thread has observed it.
+    static void try_advance() {
+        domain& d = global();
+        unsigned long e = (&d.epoch)->load();
+        for(int i = 0; i < RECLAIM_MAX_THREADS; i++) {
+            if(!(&d.records[i].in_use)->load(std::memory_order_acquire)) continue;
+            unsigned long s = (&d.records[i].state)->load();
+            if((s & 1) && (s >> 1) != e) return;
+        }
+        if(d.epoch.compare_exchange_strong(e, e + 1)) collect_orphans(e + 1);
+    }
+
+    static void enter() {
+        record* r = my_record();
+        if(r->nest++ > 0) return;
+        domain& d = global();
+        unsigned long e = (&d.epoch)->load();
+        (&r->state)->store((e << 1) | 1);
+        // Re-read in case the epoch moved before we were visible.
+        unsigned long e2 = (&d.epoch)->load();
+        if(e2 != e) (&r->state)->store((e2 << 1) | 1);
+        collect(r, e2);
+    }
+
+    static void exit() {
+        record* r = my_record();
+        if(--r->nest > 0) return;
+        (&r->state)->store(0, std::memory_order_release);
+    }
+
+    // The epoch is read after the object was unlinked, so every thread that
+    // may still reference it entered in epoch e or earlier.
+    static void retire(void* p, void (*free_fn)(void*)) {
+        record* r = my_record();
+        unsigned long e = (&global().epoch)->load();
+        bag& b = r->bags[e % 3];
+        if(b.epoch != e) { // Bag still holds objects from epoch e - 3 or older
+            free_bag(b);
+            b.epoch = e;
+        }
+        retired item = { p, free_fn };
+        b.items.push_back(item);
+        if(++r->retired_count % RECLAIM_BATCH == 0) {
+            try_advance();
+            collect(r, (&global().epoch)->load());
+        }
+    }
+
+    struct guard {
+        guard() { enter(); }
+        ~guard() { exit(); }
+    };
+};
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef LFCAS_STATS_H
+#define LFCAS_STATS_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <new>
+
+//=== Counters ======================================
+// Contention and adaptation counters. Build with -DLFCAS_STATS to enable
+// them; otherwise STAT_INC expands to a no-op and stats() reports zeros.
+enum stat_counter {
+    stat_cas_failure, // try_replace lost the race for a parent pointer
+    stat_help, // help_if_needed helped a join or range query
+    stat_split, // high_contention_adaptation replaced a base node
+    stat_join, // low_contention_adaptation secured a join
+    stat_join_abort, // secure_join_left/right found a busy neighbor or lost a CAS
+    stat_count
+};
+
+struct tree_stats {
+    unsigned long cas_failures;
+    unsigned long helps;
+    unsigned long splits;
+    unsigned long joins;
+    unsigned long join_aborts;
+};
+
+#ifdef LFCAS_STATS
+#define STAT_INC(c) stats_counters::inc(c)
+#else
+#define STAT_INC(c) ((void)0)
+#endif
+
+// Every thread counts into its own cache line, so counting never causes
+// coherence traffic. Only the owner writes a record; stats() sums them.
+// Records outlive their threads so nothing counted is lost.
+struct stats_counters {
+    struct alignas(64) record {
+        std::atomic<unsigned long> c[stat_count];
+        record() {
+            for(int i = 0; i < stat_count; i++) (&c[i])->store(0, std::memory_order_relaxed);
+        }
+    };
+
+    struct registry {
+        std::mutex lock;
+        std::vector<record*> records;
+    };
+
+    static registry& global() {
+        static registry* r = new registry(); // never destroyed, threads may outlive main
+        return *r;
+    }
+
+    static record* my_record() {
+        static thread_local record* rec = NULL;
+        if(rec == NULL) {
+            void* p;
+            if(posix_memalign(&p, 64, sizeof(record)) != 0) throw std::bad_alloc();
+            rec = new (p) record();
+            registry& r = global();
+            std::lock_guard<std::mutex> hold(r.lock);
+            r.records.push_back(rec);
+        }
+        return rec;
+    }
+
+    static void inc(stat_counter c) {
+        std::atomic<unsigned long>& v = my_record()->c[c];
+        v.store(v.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static unsigned long total(stat_counter c) {
+        registry& r = global();
+        std::lock_guard<std::mutex> hold(r.lock);
+        unsigned long sum = 0;
+        for(size_t i = 0; i < r.records.size(); i++)
+            sum += (&r.records[i]->c[c])->load(std::memory_order_relaxed);
+        return sum;
+    }
+
+    // Not synchronized with running threads; call between benchmark phases.
+    static void reset() {
+        registry& r = global();
+        std::lock_guard<std::mutex> hold(r.lock);
+        for(size_t i = 0; i < r.records.size(); i++)
+            for(int j = 0; j < stat_count; j++)
+                (&r.records[i]->c[j])->store(0, std::memory_order_relaxed);
+    }
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef LFCAS_TREAP_H
+#define LFCAS_TREAP_H
+
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <utility>
+#include <cstddef>
+#include "lfcas_pool.h"
+
+//=== Data Structures ===============================
+// Value type of sets. A leaf entry then only holds the key.
+struct no_value {};
+
+// Node of an immutable treap. Published nodes are never modified; updates
+// copy the O(log n) nodes on the search path and share every other subtree
+// with the previous version, so subtrees are reference counted.
+template <class K, class V = no_value>
+struct treap : pooled {
+    K key;
+    unsigned prio; // Heap priority, derived from the key
+    size_t size; // Number of keys in this subtree
+    std::atomic<int> refs;
+    V value; // Stored next to refs so an empty value fits in its padding
+    treap<K, V>* left; // < key
+    treap<K, V>* right; // > key
+    treap(const K& k, const V& v, unsigned p, treap<K, V>* l, treap<K, V>* r)
+        : key(k), prio(p), size(1), refs(1), value(v), left(l), right(r) {
+        if(l != NULL) size += l->size;
+        if(r != NULL) size += r->size;
+    }
+};
+
+//=== Treap Leaf Container ==========================
+// Leaf container for base nodes, as used in the LFCA tree paper. A leaf is
+// the root of an immutable treap (NULL when empty). Priorities are a hash
+// of the key, so a set of keys always has the same shape regardless of the
+// order of the updates that produced it. Keys are ordered by Compare, which
+// must be stateless, and hashed with std::hash<K>.
+//
+// Functions taking a leaf only borrow it; functions returning a leaf hand
+// the caller one reference, which is given back with `release`.
+template <class K, class V = no_value, class Compare = std::less<K> >
+struct treap_leaf {
+    typedef treap<K, V>* type;
+    typedef K key_type;
+    typedef V value_type;
+
+    static bool less(const K& a, const K& b) {
+        return Compare()(a, b);
+    }
+
+    // Entries passed to from_sorted are either keys or (key, value) pairs.
+    static const K& key_of(const K& k) { return k; }
+    static const K& key_of(const std::pair<K, V>& e) { return e.first; }
+    static V value_of(const K&) { return V(); }
+    static const V& value_of(const std::pair<K, V>& e) { return e.second; }
+
+    static unsigned priority(const K& key) {
+        size_t h = std::hash<K>()(key);
+        h ^= h >> 33; h *= 0xff51afd7ed558ccdULL; // murmur3 finalizer
+        h ^= h >> 33; h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (unsigned)h;
+    }
+
+    // True if (p1, k1) should sit above (p2, k2). Keys break priority ties.
+    static bool above(unsigned p1, const K& k1, unsigned p2, const K& k2) {
+        return p1 > p2 || (p1 == p2 && less(k1, k2));
+    }
+
+    static treap<K, V>* retain(treap<K, V>* t) {
+        if(t != NULL) (&t->refs)->fetch_add(1, std::memory_order_relaxed);
+        return t;
+    }
+
+    static void release(treap<K, V>* t) {
+        std::vector<treap<K, V>*> pending;
+        while(true) {
+            if(t != NULL && (&t->refs)->fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                pending.push_back(t->left);
+                pending.push_back(t->right);
+                delete t;
+            }
+            if(pending.empty()) return;
+            t = pending.back();
+            pending.pop_back();
+        }
+    }
+
+    // Copy of t with new children (which the copy takes ownership of).
+    static treap<K, V>* copy(treap<K, V>* t, treap<K, V>* l, treap<K, V>* r) {
+        return new treap<K, V>(t->key, t->value, t->prio, l, r);
+    }
+
+    static size_t size(treap<K, V>* t) {
+        return t == NULL ? 0 : t->size;
+    }
+
+    // The value stored with key, or NULL if key is not in t.
+    static const V* find(treap<K, V>* t, const K& key) {
+        while(t != NULL) {
+            if(less(key, t->key)) t = t->left;
+            else if(less(t->key, key)) t = t->right;
+            else return &t->value;
+        }
+        return NULL;
+    }
+
+    static bool lookup(treap<K, V>* t, const K& key) {
+        return find(t, key) != NULL;
+    }
+
+    static const K& min(treap<K, V>* t) {
+        while(t->left != NULL) t = t->left;
+        return t->key;
+    }
+
+    static const K& max(treap<K, V>* t) {
+        while(t->right != NULL) t = t->right;
+        return t->key;
+    }
+
+    // Navigation
+    // Copies t's entry to *key and, unless value is NULL, *value.
+    static bool entry(treap<K, V>* t, K* key, V* value) {
+        if(t == NULL) return false;
+        *key = t->key;
+        if(value != NULL) *value = t->value;
+        return true;
+    }
+
+    // The first entry after key, or at key if inclusive.
+    static bool next(treap<K, V>* t, const K& key, bool inclusive, K* found, V* value) {
+        treap<K, V>* best = NULL;
+        while(t != NULL) {
+            if(inclusive ? !less(t->key, key) : less(key, t->key)) {
+                best = t;
+                t = t->left;
+            } else {
+                t = t->right;
+            }
+        }
+        return entry(best, found, value);
+    }
+
+    // The last entry before key.
+    static bool prev(treap<K, V>* t, const K& key, K* found, V* value) {
+        treap<K, V>* best = NULL;
+        while(t != NULL) {
+            if(less(t->key, key)) {
+                best = t;
+                t = t->right;
+            } else {
+                t = t->left;
+            }
+        }
+        return entry(best, found, value);
+    }
+
+    static bool first(treap<K, V>* t, K* found, V* value) {
+        while(t != NULL && t->left != NULL) t = t->left;
+        return entry(t, found, value);
+    }
+
+    static bool last(treap<K, V>* t, K* found, V* value) {
+        while(t != NULL && t->right != NULL) t = t->right;
+        return entry(t, found, value);
+    }
+
+    // The key with `rank` smaller keys in t.
+    static const K& select(treap<K, V>* t, size_t rank) {
+        while(true) {
+            size_t l = size(t->left);
+            if(rank < l) {
+                t = t->left;
+            } else if(rank == l) {
+                return t->key;
+            } else {
+                rank -= l + 1;
+                t = t->right;
+            }
+        }
+    }
+
+    // Number of keys in t below key, or at most key if inclusive.
+    static size_t rank(treap<K, V>* t, const K& key, bool inclusive) {
+        size_t r = 0;
+        while(t != NULL) {
+            if(inclusive ? !less(key, t->key) : less(t->key, key)) {
+                r += size(t->left) + 1;
+                t = t->right;
+            } else {
+                t = t->left;
+            }
+        }
+        return r;
+    }
+
+    // Number of keys in [lo, hi], in O(log n) from the subtree sizes.
+    static size_t count_range(treap<K, V>* t, const K& lo, const K& hi) {
+        if(less(hi, lo)) return 0;
+        return rank(t, hi, true) - rank(t, lo, false);
+    }
+
+    // Splits t into the keys < key (*lo) and the keys >= key (*hi).
+    static void split(treap<K, V>* t, const K& key, treap<K, V>** lo, treap<K, V>** hi) {
+        if(t == NULL) {
+            *lo = *hi = NULL;
+        } else if(less(t->key, key)) {
+            treap<K, V>* a; treap<K, V>* b;
+            split(t->right, key, &a, &b);
+            *lo = copy(t, retain(t->left), a);
+            *hi = b;
+        } else {
+            treap<K, V>* a; treap<K, V>* b;
+            split(t->left, key, &a, &b);
+            *lo = a;
+            *hi = copy(t, b, retain(t->right));
+        }
+    }
+
+    // Splits t into k non-empty parts of nearly equal size, in key order.
+    // Each cut finds its key by rank in O(log n), so this is O(k log n).
+    static void split_n(treap<K, V>* t, size_t k, treap<K, V>** parts) {
+        size_t n = size(t);
+        treap<K, V>* rest = retain(t);
+        for(size_t i = 1; i < k; i++) {
+            K key = select(t, n * i / k);
+            treap<K, V>* hi;
+            split(rest, key, &parts[i - 1], &hi);
+            release(rest);
+            rest = hi;
+        }
+        parts[k - 1] = rest;
+    }
+
+    // Joins two treaps where every key in a is smaller than every key in b.
+    static treap<K, V>* join(treap<K, V>* a, treap<K, V>* b) {
+        if(a == NULL) return retain(b);
+        if(b == NULL) return retain(a);
+        if(above(a->prio, a->key, b->prio, b->key))
+            return copy(a, retain(a->left), join(a->right, b));
+        return copy(b, join(a, b->left), retain(b->right));
+    }
+
+    static treap<K, V>* insert_rec(treap<K, V>* t, const K& key, const V& value, unsigned prio) {
+        if(t == NULL || above(prio, key, t->prio, t->key)) {
+            treap<K, V>* lo; treap<K, V>* hi;
+            split(t, key, &lo, &hi);
+            return new treap<K, V>(key, value, prio, lo, hi);
+        } else if(less(key, t->key)) {
+            return copy(t, insert_rec(t->left, key, value, prio), retain(t->right));
+        } else {
+            return copy(t, retain(t->left), insert_rec(t->right, key, value, prio));
+        }
+    }
+
+    // Copies the path to key, which must be in t, giving it a new value.
+    static treap<K, V>* assign_rec(treap<K, V>* t, const K& key, const V& value) {
+        if(less(key, t->key))
+            return copy(t, assign_rec(t->left, key, value), retain(t->right));
+        if(less(t->key, key))
+            return copy(t, retain(t->left), assign_rec(t->right, key, value));
+        return new treap<K, V>(t->key, value, t->prio, retain(t->left), retain(t->right));
+    }
+
+    static treap<K, V>* remove_rec(treap<K, V>* t, const K& key) {
+        if(less(key, t->key))
+            return copy(t, remove_rec(t->left, key), retain(t->right));
+        if(less(t->key, key))
+            return copy(t, retain(t->left), remove_rec(t->right, key));
+        return join(t->left, t->right);
+    }
+
+    // Insertion and Removal
+    // *res is true if key was not in t. An existing key keeps its value
+    // unless `assign` is set.
+    static treap<K, V>* insert(treap<K, V>* t, const K& key, const V& value, bool assign, bool* res) {
+        *res = !lookup(t, key);
+        if(*res) return insert_rec(t, key, value, priority(key));
+        if(assign) return assign_rec(t, key, value);
+        return retain(t);
+    }
+
+    static treap<K, V>* remove(treap<K, V>* t, const K& key, bool* res) {
+        *res = lookup(t, key);
+        if(!*res) return retain(t);
+        return remove_rec(t, key);
+    }
+
+    // Inserts the sorted, duplicate free entries [first, last), keeping the
+    // value of keys already in t. *added counts the new keys.
+    template <class It>
+    static treap<K, V>* insert_batch(treap<K, V>* t, It first, It last, size_t* added) {
+        treap<K, V>* cur = retain(t);
+        *added = 0;
+        for(; first != last; ++first) {
+            bool res;
+            treap<K, V>* next = insert(cur, key_of(*first), value_of(*first), false, &res);
+            release(cur); // only frees the path copied by the previous insert
+            cur = next;
+            *added += res;
+        }
+        return cur;
+    }
+
+    // Removes the sorted, duplicate free keys [first, last). *removed counts
+    // the keys that were in t.
+    template <class It>
+    static treap<K, V>* remove_batch(treap<K, V>* t, It first, It last, size_t* removed) {
+        treap<K, V>* cur = retain(t);
+        *removed = 0;
+        for(; first != last; ++first) {
+            bool res;
+            treap<K, V>* next = remove(cur, key_of(*first), &res);
+            release(cur);
+            cur = next;
+            *removed += res;
+        }
+        return cur;
+    }
+
+    // Builds a treap from sorted, duplicate free entries in linear time by
+    // keeping the right spine on a stack.
+    template <class It>
+    static treap<K, V>* from_sorted(It first, It last) {
+        std::vector<treap<K, V>*> spine;
+        for(; first != last; ++first) {
+            const K& key = key_of(*first);
+            unsigned p = priority(key);
+            treap<K, V>* left = NULL;
+            while(!spine.empty() && above(p, key, spine.back()->prio, spine.back()->key)) {
+                treap<K, V>* top = spine.back();
+                spine.pop_back();
+                top->right = left;
+                top->size = 1 + size(top->left) + size(left);
+                left = top;
+            }
+            spine.push_back(new treap<K, V>(key, value_of(*first), p, left, NULL));
+        }
+        treap<K, V>* right = NULL;
+        while(!spine.empty()) {
+            treap<K, V>* top = spine.back();
+            spine.pop_back();
+            top->right = right;
+            top->size = 1 + size(top->left) + size(right);
+            right = top;
+        }
+        return right;
+    }
+
+    // Calls f(key, value) for the keys in [lo, hi] in ascending order.
+    template <class F>
+    static void visit_range(treap<K, V>* t, const K& lo, const K& hi, F& f) {
+        if(t == NULL) return;
+        if(less(lo, t->key)) visit_range(t->left, lo, hi, f);
+        if(!less(t->key, lo) && !less(hi, t->key)) f(t->key, t->value);
+        if(less(t->key, hi)) visit_range(t->right, lo, hi, f);
+    }
+};
+
+#endif
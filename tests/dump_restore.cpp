@@ -0,0 +1,114 @@
+// Dump and restore. A restored tree must hold the dumped entries, take
+// updates, and stay safe to free: its file is only unmapped once the
+// leaves retired by those updates are freed, which happens while other
+// trees are in use after it was deleted.
+//
+// $ g++ tests/dump_restore.cpp -std=c++11 -O2 -pthread -o dump_restore && ./dump_restore
+#define LFCAS_NO_MAIN
+#include "../lfcas.cpp"
+#include <map>
+
+typedef lfcatree<int, long, std::less<int>, flat_leaf> tree_t;
+static const int THREADS = 4;
+
+static long compare(tree_t* lfca, tree_t::tree_type* tree, const std::map<int, long>& ref) {
+    long bad = 0;
+    std::map<int, long>::const_iterator it = ref.begin();
+    lfca->scan(tree, [&](const int& key, const long& value) {
+        if(it == ref.end() || it->first != key || it->second != value) bad++;
+        else ++it;
+    });
+    return bad + (it != ref.end());
+}
+
+// Dumps a one-leaf tree, overwrites the size and capacity of its leaf, and
+// restores it, which must fail: a capacity below a full search window would
+// let lookups read outside the leaf.
+template <class K>
+static long corrupt_cap(const char* path, size_t size, size_t cap) {
+    typedef lfcatree<K, long, std::less<K>, flat_leaf> small_t;
+    small_t lfca;
+    typename small_t::tree_type* tree = lfca.create();
+    for(int i = 0; i < 10; i++) lfca.insert(tree, i, i);
+    lfca.dump(tree, path);
+    FILE* f = fopen(path, "r+b");
+    fseek(f, sizeof(dump_header), SEEK_SET); // the first leaf's size and cap
+    fwrite(&size, sizeof(size), 1, f);
+    fwrite(&cap, sizeof(cap), 1, f);
+    fclose(f);
+    lfca.destroy(tree);
+    return lfca.restore(path) != NULL;
+}
+
+int main() {
+    const char* path = "dump_restore.dump";
+    tree_t lfca;
+    long bad = 0;
+    std::map<int, long> ref;
+    xorshift r(5);
+    tree_t::tree_type* tree = lfca.create();
+    for(int i = 0; i < 100000; i++) {
+        int key = r.next() % 1000000;
+        if(lfca.insert(tree, key, i)) ref[key] = i;
+    }
+    if(!lfca.dump(tree, path, 100)) bad++;
+    tree_t::tree_type* restored = lfca.restore(path);
+    if(restored == NULL) {
+        printf("FAILED\n");
+        return 1;
+    }
+    bad += compare(&lfca, restored, ref);
+
+    std::vector<std::map<int, long> > parts(THREADS); // each thread updates the keys k with k % THREADS == w
+    for(std::map<int, long>::iterator it = ref.begin(); it != ref.end(); ++it) parts[it->first % THREADS][it->first] = it->second;
+    std::atomic<long> wrong(0);
+    std::vector<std::thread> threads;
+    for(int w = 0; w < THREADS; w++) {
+        threads.push_back(std::thread([&, w]() {
+            xorshift q(w + 11);
+            for(int i = 0; i < 100000; i++) {
+                int key = 500000 + (q.next() % 125000) * THREADS + w; // the lower half stays mapped
+                if(q.next() & 1) {
+                    if(lfca.put(restored, key, i) != (parts[w].count(key) == 0)) wrong++;
+                    parts[w][key] = i;
+                } else if(lfca.remove(restored, key) != (parts[w].erase(key) == 1)) {
+                    wrong++;
+                }
+            }
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); i++) threads[i].join();
+    ref.clear();
+    for(int w = 0; w < THREADS; w++) ref.insert(parts[w].begin(), parts[w].end());
+    bad += wrong + compare(&lfca, restored, ref);
+    for(int i = 0; i < 1000; i++) { // copies mapped leaves, which this thread's reclaimer keeps for now
+        if(!lfca.remove(restored, ref.begin()->first)) bad++;
+        ref.erase(ref.begin());
+    }
+
+    lfca.destroy(restored); // leaves retired by the updates are still waiting
+    threads.clear();
+    for(int w = 0; w < THREADS; w++) { // lets the reclaimer free them
+        threads.push_back(std::thread([&, w]() {
+            xorshift q(w + 21);
+            for(int i = 0; i < 200000; i++) lfca.insert(tree, q.next() % 1000000, i);
+        }));
+    }
+    for(size_t i = 0; i < threads.size(); i++) threads[i].join();
+    for(int i = 0; i < 100000; i++) lfca.insert(tree, r.next() % 1000000, i);
+
+    tree_t::tree_type* empty = lfca.create();
+    lfca.dump(empty, path);
+    tree_t::tree_type* restored_empty = lfca.restore(path);
+    if(restored_empty == NULL || !lfca.insert(restored_empty, 1, 1) || !lfca.lookup(restored_empty, 1)) bad++;
+    if(restored_empty != NULL) lfca.destroy(restored_empty);
+    lfca.destroy(empty);
+    if(lfca.restore("dump_restore.missing") != NULL) bad++;
+    if(lfca.dump(tree, "dump_restore.missing/dir/file")) bad++;
+    bad += corrupt_cap<int>(path, 0, 0) + corrupt_cap<long>(path, 1, 8);
+    remove(path);
+    lfca.destroy(tree);
+
+    printf("%s\n", bad == 0 ? "ok" : "FAILED");
+    return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,42 @@
+// Leaf sizes after large batch updates. A batch can grow a base node far
+// past MAX_LEAF_SIZE, and the split that follows must bring every part
+// back under it at once.
+//
+// $ g++ tests/split_size.cpp -std=c++11 -O2 -pthread -o split_size && ./split_size
+#define LFCAS_NO_MAIN
+#include "../lfcas.cpp"
+
+template <class Tree>
+static size_t largest_leaf(node<int, typename Tree::Leaf>* n) {
+    if(n->type == route) {
+        route_node<int, typename Tree::Leaf>* r = static_cast<route_node<int, typename Tree::Leaf>*>(n);
+        return std::max(largest_leaf<Tree>((&r->left)->load()), largest_leaf<Tree>((&r->right)->load()));
+    }
+    return Tree::Leaf::size(static_cast<base_node<int, typename Tree::Leaf>*>(n)->data);
+}
+
+template <template <class, class, class> class LeafT>
+static long run() {
+    typedef lfcatree<int, no_value, std::less<int>, LeafT> tree_t;
+    tree_t lfca;
+    long bad = 0;
+    typename tree_t::tree_type* tree = lfca.create();
+    std::vector<int> keys;
+    for(int i = 0; i < 20000; i++) keys.push_back(i * 3);
+    if(lfca.insert_batch(tree, keys.begin(), keys.end()) != keys.size()) bad++;
+    if(largest_leaf<tree_t>((&tree->root)->load()) > MAX_LEAF_SIZE) bad++;
+    for(size_t i = 0; i < keys.size(); i++) if(!lfca.lookup(tree, keys[i])) bad++;
+
+    keys.clear(); // a second batch landing in one existing base node
+    for(int i = 0; i < 5000; i++) keys.push_back(30000 + i * 3 + 1);
+    lfca.insert_batch(tree, keys.begin(), keys.end());
+    if(largest_leaf<tree_t>((&tree->root)->load()) > MAX_LEAF_SIZE) bad++;
+    lfca.destroy(tree);
+    return bad;
+}
+
+int main() {
+    long bad = run<treap_leaf>() + run<flat_leaf>();
+    printf("%s\n", bad == 0 ? "ok" : "FAILED");
+    return bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// Range queries running against multi-key updates. Movers keep N tokens
+// on the even keys below 2 * K, each on its own keys, so every snapshot a
+// query returns must hold exactly N tokens with values 0..N-1. An update
+// with a repeated key is refused without changing anything.
+//
+// $ g++ tests/txn_range.cpp -std=c++11 -O2 -pthread -o txn_range && ./txn_range
+#define LFCAS_NO_MAIN
+#include "../lfcas.cpp"
+
+static const int K = 4000, N = 300, THREADS = 3, SECS = 2;
+
+template <template <class, class, class> class LeafT>
+static long run() {
+    typedef lfcatree<int, long, std::less<int>, LeafT> tree_t;
+    tree_t lfca;
+    typename tree_t::tree_type* tree = lfca.create();
+    for(int i = 0; i < N; i++) lfca.insert(tree, i * 2 * (K / N), i);
+
+    std::atomic<bool> stop(false);
+    std::atomic<long> bad(0), queries(0);
+    std::vector<std::thread> threads;
+    for(int w = 0; w < THREADS; w++) {
+        threads.push_back(std::thread([&, w]() { // moves tokens between keys k with k / 2 % THREADS == w
+            xorshift r(w + 7);
+            while(!stop) {
+                int from = ((r.next() % K) / THREADS * THREADS + w) * 2;
+                int to = ((r.next() % K) / THREADS * THREADS + w) * 2;
+                if(from < 2 * K && to < 2 * K && !lfca.lookup(tree, to)) lfca.move(tree, from, to);
+            }
+        }));
+        threads.push_back(std::thread([&, w]() {
+            xorshift r(w + 77);
+            while(!stop) {
+                int lo = r.next() % 100 == 0 ? 0 : (int)(r.next() % (2 * K));
+                int hi = lo == 0 ? 2 * K : lo + (int)(r.next() % 400);
+                range_result<int, typename tree_t::Leaf> res = lfca.query(tree, lo, hi);
+                long count = 0, sum = 0;
+                res.for_each_entry([&](int key, long value) {
+                    if(key < lo || key > hi || key % 2 != 0) bad++;
+                    count++;
+                    sum += value;
+                });
+                if(lo == 0 && (count != N || sum != (long)N * (N - 1) / 2)) bad++;
+                queries++;
+            }
+        }));
+    }
+    sleep(SECS);
+    stop = true;
+    for(size_t i = 0; i < threads.size(); i++) threads[i].join();
+    if(queries == 0) bad++;
+
+    const int a = 2 * K + 1, b = 2 * K + 3; // past the movers' keys
+    lfca.insert(tree, a, 0);
+    std::vector<update_op<int, long> > ops = { {'p', b, 10, false}, {'r', a, 0, false}, {'i', b, 11, false} };
+    if(lfca.update(tree, &ops) || lfca.lookup(tree, b) || !lfca.lookup(tree, a)) bad++;
+    ops.pop_back();
+    long value = 0;
+    if(!lfca.update(tree, &ops) || !lfca.get(tree, b, &value) || value != 10 || lfca.lookup(tree, a)) bad++;
+    lfca.destroy(tree);
+    return bad;
+}
+
+int main() {
+    long bad = run<treap_leaf>() + run<flat_leaf>();
+    printf("%s\n", bad == 0 ? "ok" : "FAILED");
+    return bad == 0 ? 0 : 1;
+}